@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * canlog.c - candump compatible log line formatting and parsing
+ */
+
+#include "canlog.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+int canlog_format(
+  char * buf, size_t len, const struct timeval * tv, const char * ifname,
+  const struct can_frame * cf)
+{
+  char data[2 * CAN_MAX_DLEN + 1];
+  char * p = data;
+  int i;
+
+  if (cf->can_id & CAN_RTR_FLAG) {
+    *p++ = 'R';
+  } else {
+    for (i = 0; i < cf->len && i < CAN_MAX_DLEN; i++) {
+      *p++ = hex_digits[cf->data[i] >> 4];
+      *p++ = hex_digits[cf->data[i] & 0x0F];
+    }
+  }
+  *p = '\0';
+
+  /* extended and error frames use 8 digits, like candump does */
+  if (cf->can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG))
+    return snprintf(
+      buf, len, "(%ld.%06ld) %s %08X#%s\n", (long)tv->tv_sec, (long)tv->tv_usec, ifname,
+      cf->can_id & (CAN_EFF_MASK | CAN_ERR_FLAG), data);
+
+  return snprintf(
+    buf, len, "(%ld.%06ld) %s %03X#%s\n", (long)tv->tv_sec, (long)tv->tv_usec, ifname,
+    cf->can_id & CAN_SFF_MASK, data);
+}
+
+static int hex_nibble(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+int canlog_parse_id(const char * s, char ** end, canid_t * can_id)
+{
+  unsigned long id;
+
+  id = strtoul(s, end, 16);
+  if (*end == s || !isxdigit((unsigned char)*s) || id > CAN_EFF_MASK) return -1;
+
+  *can_id = *end - s > 3 || id > CAN_SFF_MASK ? id | CAN_EFF_FLAG : id;
+  return 0;
+}
+
+int canlog_parse(const char * line, struct timeval * tv, char * ifname, struct can_frame * cf)
+{
+  const char * p = line;
+  const char * id_start;
+  char * end;
+  unsigned long id;
+  size_t n;
+  int hi, lo;
+
+  /* "(sec.usec) " */
+  if (*p++ != '(') return -1;
+  tv->tv_sec = strtol(p, &end, 10);
+  if (*end != '.') return -1;
+  p = end + 1;
+  tv->tv_usec = strtol(p, &end, 10);
+  if (*end != ')' || end - p != 6) return -1;
+  p = end + 1;
+
+  /* "ifname " */
+  while (*p == ' ') p++;
+  n = strcspn(p, " ");
+  if (!n || n >= IFNAMSIZ || !p[n]) return -1;
+  if (ifname) {
+    memcpy(ifname, p, n);
+    ifname[n] = '\0';
+  }
+  p += n + 1;
+
+  /* "ID#" with 3 digits for standard and 8 for extended/error frames */
+  memset(cf, 0, sizeof(*cf));
+  id_start = p;
+  id = strtoul(p, &end, 16);
+  if (*end != '#' || (end - id_start != 3 && end - id_start != 8)) return -1;
+  if (end - id_start == 3)
+    cf->can_id = id & CAN_SFF_MASK;
+  else if (id & CAN_ERR_FLAG)
+    cf->can_id = id & (CAN_ERR_MASK | CAN_ERR_FLAG);
+  else
+    cf->can_id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  p = end + 1;
+
+  /* "R[dlc]" or data bytes; CAN FD ("##") is not supported */
+  if (*p == 'R') {
+    cf->can_id |= CAN_RTR_FLAG;
+    if (p[1] >= '0' && p[1] <= '8') cf->len = p[1] - '0';
+    return 0;
+  }
+
+  while (isxdigit((unsigned char)p[0])) {
+    hi = hex_nibble(p[0]);
+    lo = hex_nibble(p[1]);
+    if (lo < 0 || cf->len == CAN_MAX_DLEN) return -1;
+    cf->data[cf->len++] = hi << 4 | lo;
+    p += 2;
+  }
+
+  return *p && !isspace((unsigned char)*p) ? -1 : 0;
+}
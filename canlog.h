@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * canlog.h - candump compatible log line formatting and parsing
+ */
+
+#ifndef H_SLCAND_CANLOG_H
+#define H_SLCAND_CANLOG_H
+
+#include <linux/can.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+/* Longest line: "(sec.usec) ifname 12345678#R" or 16 hex data digits */
+#define CANLOG_LINE_LENGTH (24 + IFNAMSIZ + 10 + 2 * CAN_MAX_DLEN + 2)
+
+/* Format "(1700000000.123456) can0 123#DEADBEEF\n" into buf, returns its length */
+int canlog_format(
+  char * buf, size_t len, const struct timeval * tv, const char * ifname,
+  const struct can_frame * cf);
+
+/*
+ * Parse a hex identifier at the start of s and set *end past it. Like cansend,
+ * more than 3 digits or a value beyond 11 bits is an extended frame and gets
+ * CAN_EFF_FLAG in can_id. Returns -1 without digits or above 29 bits.
+ */
+int canlog_parse_id(const char * s, char ** end, canid_t * can_id);
+
+/* Parse a classic CAN log line; ifname (IFNAMSIZ bytes) may be NULL. Returns 0 or -1 */
+int canlog_parse(const char * line, struct timeval * tv, char * ifname, struct can_frame * cf);
+
+#endif /* H_SLCAND_CANLOG_H */
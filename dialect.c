@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * dialect.c - SLCAN adapter firmware dialects
+ *
+ * Adapters speaking SLCAN differ in which optional commands they implement
+ * and in their defaults. The dialect is resolved once at startup, either by
+ * name or from the version strings the adapter reports, and only its own
+ * command sequence is sent afterwards.
+ */
+
+#include "dialect.h"
+
+#include <asm-generic/ioctls.h>
+#include <asm-generic/termbits.h>
+#include <ctype.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "h_slcand.h"
+
+/* How long to wait for a version reply */
+#define DIALECT_REPLY_MS 200
+
+/* Time for the adapter to stop sending frames after 'C' */
+#define DIALECT_SETTLE_US 20000
+
+/* Longest version reply kept */
+#define DIALECT_REPLY_LENGTH 64
+
+void send_command(int fd, const char * cmd)
+{
+  if (write(fd, cmd, strlen(cmd)) <= 0) {
+    perror("write");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static int contains_nocase(const char * s, const char * word)
+{
+  size_t n = strlen(word);
+
+  for (; *s; s++) {
+    if (!strncasecmp(s, word, n)) return 1;
+  }
+  return 0;
+}
+
+/* "Vhhss": two hardware and two software version digits */
+static int is_lawicel_version(const char * s, char cmd)
+{
+  int i;
+
+  if (s[0] != cmd) return 0;
+  for (i = 1; i < 5; i++) {
+    if (!isxdigit((unsigned char)s[i])) return 0;
+  }
+  return s[5] == '\0';
+}
+
+static int match_panther(const char * hw, const char * sw)
+{
+  return contains_nocase(hw, "panther") || contains_nocase(hw, "husarion") ||
+         contains_nocase(sw, "panther") || contains_nocase(sw, "husarion");
+}
+
+static int match_canable(const char * hw, const char * sw)
+{
+  return contains_nocase(hw, "canable") || contains_nocase(hw, "candlelight") ||
+         contains_nocase(sw, "canable") || contains_nocase(sw, "candlelight");
+}
+
+/* USBtin answers 'v' with its firmware version, plain Lawicel firmware does not */
+static int match_usbtin(const char * hw, const char * sw)
+{
+  return is_lawicel_version(hw, 'V') && is_lawicel_version(sw, 'v');
+}
+
+static int match_lawicel(const char * hw, const char * sw)
+{
+  (void)sw;
+  return is_lawicel_version(hw, 'V');
+}
+
+/* Timestamps cost four characters of UART time per frame and are unused */
+static void prepare_timestamps_off(int fd)
+{
+  send_command(fd, "C\rZ0\r");
+}
+
+static const struct slcan_dialect dialects[] = {
+  {"generic", DIALECT_STATUS_FLAGS | DIALECT_BTR, NULL, NULL},
+  {"panther", DIALECT_STATUS_FLAGS | DIALECT_BTR, match_panther, NULL},
+  {"canable", 0, match_canable, NULL},
+  {"usbtin", DIALECT_STATUS_FLAGS | DIALECT_BTR, match_usbtin, prepare_timestamps_off},
+  {"lawicel", DIALECT_STATUS_FLAGS | DIALECT_BTR, match_lawicel, prepare_timestamps_off},
+};
+
+#define DIALECT_COUNT (sizeof(dialects) / sizeof(dialects[0]))
+
+/* Send a query and collect the first reply line starting with the query character */
+static void query(int fd, const char * cmd, char * reply)
+{
+  char buf[DIALECT_REPLY_LENGTH];
+  size_t len = 0;
+  struct pollfd pfd = {fd, POLLIN, 0};
+  ssize_t n;
+
+  reply[0] = '\0';
+  ioctl(fd, TCFLSH, TCIFLUSH);
+  send_command(fd, cmd);
+
+  while (poll(&pfd, 1, DIALECT_REPLY_MS) > 0) {
+    n = read(fd, &buf[len], 1);
+    if (n <= 0) break;
+
+    /* replies end with CR, errors are a lone BEL */
+    if (buf[len] == '\r' || buf[len] == '\a') {
+      buf[len] = '\0';
+      if (buf[0] == cmd[0]) {
+        strcpy(reply, buf);
+        return;
+      }
+      len = 0;
+    } else if (len < sizeof(buf) - 1) {
+      len++;
+    }
+  }
+}
+
+const struct slcan_dialect * dialect_identify(int fd)
+{
+  char hw[DIALECT_REPLY_LENGTH];
+  char sw[DIALECT_REPLY_LENGTH];
+  size_t i;
+
+  /* close the channel first so frame traffic does not bury the reply */
+  send_command(fd, "C\r");
+  usleep(DIALECT_SETTLE_US);
+  query(fd, "V\r", hw);
+  query(fd, "v\r", sw);
+
+  for (i = 1; i < DIALECT_COUNT; i++) {
+    if (dialects[i].match(hw, sw)) break;
+  }
+  if (i == DIALECT_COUNT) i = 0;
+
+  syslogger(
+    LOG_NOTICE, "adapter reports '%s' '%s', using %s dialect\n", hw, sw, dialects[i].name);
+  return &dialects[i];
+}
+
+const struct slcan_dialect * dialect_find(const char * name)
+{
+  size_t i;
+
+  for (i = 0; i < DIALECT_COUNT; i++) {
+    if (!strcmp(name, dialects[i].name)) return &dialects[i];
+  }
+  return NULL;
+}
+
+void dialect_restrict(const struct slcan_dialect * d, struct slcan_setup * setup)
+{
+  if (setup->btr && !(d->flags & DIALECT_BTR)) {
+    syslogger(LOG_NOTICE, "%s adapters do not support bit time registers\n", d->name);
+    setup->btr = NULL;
+  }
+
+  if (setup->read_status_flags && !(d->flags & DIALECT_STATUS_FLAGS)) {
+    syslogger(LOG_NOTICE, "%s adapters do not support status flags\n", d->name);
+    setup->read_status_flags = 0;
+  }
+}
+
+void send_setup_commands(int fd, const struct slcan_setup * setup)
+{
+  char buf[20];
+
+  if (setup->speed) {
+    sprintf(buf, "C\rS%s\r", setup->speed);
+    send_command(fd, buf);
+  }
+
+  if (setup->btr) {
+    sprintf(buf, "C\rs%s\r", setup->btr);
+    send_command(fd, buf);
+  }
+
+  if (setup->read_status_flags) send_command(fd, "F\r");
+
+  if (setup->listen)
+    send_command(fd, "L\r");
+  else if (setup->open)
+    send_command(fd, "O\r");
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * dialect.h - SLCAN adapter firmware dialects
+ */
+
+#ifndef H_SLCAND_DIALECT_H
+#define H_SLCAND_DIALECT_H
+
+/* Adapter setup requested on the command line */
+struct slcan_setup
+{
+  const char * speed;
+  const char * btr;
+  int read_status_flags;
+  int listen;
+  int open;
+};
+
+/* Dialect capabilities */
+#define DIALECT_STATUS_FLAGS 0x01 /* supports 'F' */
+#define DIALECT_BTR 0x02 /* supports 's' */
+
+struct slcan_dialect
+{
+  const char * name;
+  unsigned int flags;
+
+  /* Identify the firmware from its 'V' and 'v' replies (either may be empty) */
+  int (*match)(const char * hw_version, const char * sw_version);
+
+  /* Commands needed on every bring-up path, sent before the ldisc is attached */
+  void (*prepare)(int fd);
+};
+
+/* Look a dialect up by name, "auto" queries the adapter */
+const struct slcan_dialect * dialect_find(const char * name);
+const struct slcan_dialect * dialect_identify(int fd);
+
+/* Drop the parts of the setup the dialect does not implement */
+void dialect_restrict(const struct slcan_dialect * d, struct slcan_setup * setup);
+
+/* Configure and open the adapter by writing SLCAN commands before attaching */
+void send_setup_commands(int fd, const struct slcan_setup * setup);
+
+/* Write a raw SLCAN command, exits on failure */
+void send_command(int fd, const char * cmd);
+
+#endif /* H_SLCAND_DIALECT_H */
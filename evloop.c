@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * evloop.c - minimal epoll based event loop driving the h_slcand modules
+ *
+ * A callback may unregister and free any source, including ones with events
+ * still waiting in the batch being dispatched; ev_del() forgets those.
+ */
+
+#include "evloop.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Number of events fetched per epoll_wait() */
+#define EV_BATCH 16
+
+static int epfd = -1;
+
+/* Batch being dispatched, and the index of the event after the current one */
+static struct epoll_event batch[EV_BATCH];
+static int batch_count;
+static int batch_next;
+
+int ev_init(void)
+{
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  return epfd;
+}
+
+void ev_close(void)
+{
+  if (epfd >= 0) close(epfd);
+  epfd = -1;
+}
+
+int ev_add(struct ev_source * src, unsigned int events)
+{
+  struct epoll_event ev;
+
+  ev.events = events;
+  ev.data.ptr = src;
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+int ev_mod(struct ev_source * src, unsigned int events)
+{
+  struct epoll_event ev;
+
+  ev.events = events;
+  ev.data.ptr = src;
+  return epoll_ctl(epfd, EPOLL_CTL_MOD, src->fd, &ev);
+}
+
+int ev_del(struct ev_source * src)
+{
+  int i;
+
+  for (i = batch_next; i < batch_count; i++) {
+    if (batch[i].data.ptr == src) batch[i].data.ptr = NULL;
+  }
+  return epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+}
+
+int ev_run_once(int timeout_ms)
+{
+  uint64_t begin = trace_enabled ? trace_now() : 0;
+  int n, i;
+
+  n = epoll_wait(epfd, batch, EV_BATCH, timeout_ms);
+  if (trace_enabled) trace_span(TRACE_POLL_WAIT, begin, trace_now(), n > 0 ? n : 0);
+  if (n < 0) return errno == EINTR ? 0 : -1;
+
+  batch_count = n;
+  for (i = 0; i < n; i++) {
+    struct ev_source * src = batch[i].data.ptr;
+
+    batch_next = i + 1;
+    if (src) src->cb(src->ctx, batch[i].events);
+  }
+  batch_count = 0;
+
+  return n;
+}
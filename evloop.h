@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * evloop.h - minimal epoll based event loop driving the h_slcand modules
+ */
+
+#ifndef H_SLCAND_EVLOOP_H
+#define H_SLCAND_EVLOOP_H
+
+typedef void (*ev_cb_t)(void * ctx, unsigned int events);
+
+/* A file descriptor watched by the loop; owned by the registering module */
+struct ev_source
+{
+  int fd;
+  ev_cb_t cb;
+  void * ctx;
+};
+
+int ev_init(void);
+void ev_close(void);
+
+/*
+ * Register, change or unregister a source for the given EPOLL* events. Once
+ * unregistered a source gets no more callbacks, not even for events already
+ * fetched, so it may be freed right away.
+ */
+int ev_add(struct ev_source * src, unsigned int events);
+int ev_mod(struct ev_source * src, unsigned int events);
+int ev_del(struct ev_source * src);
+
+/* Wait up to timeout_ms and dispatch ready sources; interrupted waits return 0 */
+int ev_run_once(int timeout_ms);
+
+#endif /* H_SLCAND_EVLOOP_H */
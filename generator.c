@@ -0,0 +1,387 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * generator.c - paced CAN traffic generator for bus load testing
+ *
+ * Frames are written to the shared transmit path on the slcan netdevice, from
+ * where the line discipline encodes them straight onto the UART. Every frame has
+ * an exact due time derived from the start time, so the average rate never
+ * drifts. The event loop timer is armed at the next due time, but never
+ * closer than GEN_MIN_TICK_NS: low rates are sent one frame per wakeup at
+ * the exact moment, high rates in one batch per wakeup.
+ * A frame the kernel cannot queue is counted as dropped and not retried.
+ */
+
+#define _GNU_SOURCE
+
+#include "generator.h"
+
+#include <errno.h>
+#include <linux/can.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "canlog.h"
+#include "evloop.h"
+#include "h_slcand.h"
+#include "tx.h"
+
+/* Shortest time between two wakeups */
+#define GEN_MIN_TICK_NS 100000ULL
+
+/* Frames sent per batch */
+#define GEN_BATCH 64
+
+/* Interval of the achieved rate reports */
+#define GEN_REPORT_NS 1000000000ULL
+
+enum gen_data
+{
+  GEN_DATA_INC,
+  GEN_DATA_RAND,
+  GEN_DATA_FIXED,
+};
+
+struct gen_replay
+{
+  uint64_t offset;
+  struct can_frame frame;
+};
+
+struct generator
+{
+  struct ev_source src;
+
+  /* pattern */
+  double rate;
+  canid_t id_lo;
+  canid_t id_hi;
+  int eff;
+  int id_rand;
+  int dlc;
+  enum gen_data data;
+  struct can_frame fixed;
+  uint64_t limit;
+
+  /* replay */
+  struct gen_replay * replay;
+  size_t replay_count;
+  double speed;
+
+  uint64_t start;
+  uint64_t next;
+  uint64_t sent;
+  uint64_t dropped;
+  uint64_t report_from;
+  uint64_t report_sent;
+  uint32_t rng;
+  int done;
+
+  struct can_frame frames[GEN_BATCH];
+};
+
+static uint32_t xorshift32(uint32_t * state)
+{
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static uint64_t gen_due(const struct generator * gen, uint64_t i)
+{
+  if (gen->replay) return gen->start + (uint64_t)(gen->replay[i].offset / gen->speed);
+  return gen->start + (uint64_t)((double)i * NSEC_PER_SEC / gen->rate);
+}
+
+static void gen_frame(struct generator * gen, uint64_t i, struct can_frame * cf)
+{
+  canid_t span = gen->id_hi - gen->id_lo + 1;
+  int b;
+
+  if (gen->replay) {
+    *cf = gen->replay[i].frame;
+    return;
+  }
+
+  memset(cf, 0, sizeof(*cf));
+  cf->can_id = gen->id_lo + (gen->id_rand ? xorshift32(&gen->rng) : i) % span;
+  if (gen->eff) cf->can_id |= CAN_EFF_FLAG;
+  cf->len = gen->dlc < 0 ? xorshift32(&gen->rng) % (CAN_MAX_DLEN + 1) : (uint32_t)gen->dlc;
+
+  switch (gen->data) {
+    case GEN_DATA_INC:
+      for (b = 0; b < cf->len; b++) cf->data[b] = i >> (8 * b);
+      break;
+    case GEN_DATA_RAND:
+      for (b = 0; b < cf->len; b++) cf->data[b] = xorshift32(&gen->rng);
+      break;
+    case GEN_DATA_FIXED:
+      memcpy(cf->data, gen->fixed.data, cf->len);
+      break;
+  }
+}
+
+static uint64_t gen_total(const struct generator * gen)
+{
+  return gen->replay ? gen->replay_count : gen->limit;
+}
+
+static void gen_report(struct generator * gen, uint64_t now, const char * what)
+{
+  double dt = (double)(now - gen->start) / NSEC_PER_SEC;
+
+  syslogger(
+    LOG_INFO, "generator %s: %llu frames in %.3f s (%.1f fps), %llu dropped\n", what,
+    (unsigned long long)gen->sent, dt, dt > 0 ? gen->sent / dt : 0,
+    (unsigned long long)gen->dropped);
+}
+
+static void gen_arm(struct generator * gen, uint64_t at)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = at / NSEC_PER_SEC;
+  its.it_value.tv_nsec = at % NSEC_PER_SEC;
+  timerfd_settime(gen->src.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void gen_tick(void * ctx, unsigned int events)
+{
+  struct generator * gen = ctx;
+  uint64_t total = gen_total(gen);
+  uint64_t expirations;
+  uint64_t now = now_ns();
+  uint64_t due;
+  int n, sent;
+
+  (void)events;
+
+  if (read(gen->src.fd, &expirations, sizeof(expirations)) < 0) return;
+
+  do {
+    for (n = 0; n < GEN_BATCH && (!total || gen->next < total); n++) {
+      if (gen_due(gen, gen->next) > now) break;
+      gen_frame(gen, gen->next++, &gen->frames[n]);
+    }
+    if (!n) break;
+
+    sent = tx_send(gen->frames, n);
+    gen->sent += sent;
+    gen->dropped += n - sent;
+  } while (n == GEN_BATCH);
+
+  if (now - gen->report_from >= GEN_REPORT_NS) {
+    syslogger(
+      LOG_INFO, "generator: %.1f fps, %llu dropped\n",
+      (double)(gen->sent - gen->report_sent) * NSEC_PER_SEC / (now - gen->report_from),
+      (unsigned long long)gen->dropped);
+    gen->report_from = now;
+    gen->report_sent = gen->sent;
+  }
+
+  if (total && gen->next == total) {
+    gen->done = 1;
+    gen_report(gen, now, "done");
+    return;
+  }
+
+  now = now_ns();
+  due = gen_due(gen, gen->next);
+  gen_arm(gen, due > now + GEN_MIN_TICK_NS ? due : now + GEN_MIN_TICK_NS);
+}
+
+static int gen_load_replay(struct generator * gen, const char * path)
+{
+  char line[CANLOG_LINE_LENGTH + 64];
+  struct timeval tv, first = {0, 0};
+  struct can_frame cf;
+  size_t alloc = 0;
+  FILE * f;
+
+  f = fopen(path, "r");
+  if (!f) return -1;
+
+  while (fgets(line, sizeof(line), f)) {
+    if (canlog_parse(line, &tv, NULL, &cf) < 0) continue;
+
+    /* error frames cannot be sent */
+    if (cf.can_id & CAN_ERR_FLAG) continue;
+
+    if (gen->replay_count == alloc) {
+      struct gen_replay * r;
+
+      alloc = alloc ? 2 * alloc : 1024;
+      r = realloc(gen->replay, alloc * sizeof(*r));
+      if (!r) {
+        fclose(f);
+        return -1;
+      }
+      gen->replay = r;
+    }
+
+    if (!gen->replay_count) first = tv;
+    gen->replay[gen->replay_count].offset =
+      (uint64_t)(tv.tv_sec - first.tv_sec) * NSEC_PER_SEC +
+      ((int64_t)tv.tv_usec - first.tv_usec) * 1000;
+    gen->replay[gen->replay_count++].frame = cf;
+  }
+
+  fclose(f);
+  if (!gen->replay_count) {
+    errno = ENODATA;
+    return -1;
+  }
+  return 0;
+}
+
+static int gen_parse_hex(const char * s, struct can_frame * cf)
+{
+  char byte[3] = {0, 0, 0};
+  char * end;
+
+  for (cf->len = 0; s[0] && s[1]; s += 2) {
+    if (cf->len == CAN_MAX_DLEN) return -1;
+    byte[0] = s[0];
+    byte[1] = s[1];
+    cf->data[cf->len++] = strtoul(byte, &end, 16);
+    if (*end) return -1;
+  }
+  return *s ? -1 : 0;
+}
+
+static int gen_parse(struct generator * gen, char * spec)
+{
+  enum { RATE, ID, DIST, DLC, DATA, COUNT, REPLAY, SPEED };
+  char * const keys[] = {"rate", "id", "dist", "dlc", "data", "count", "replay", "speed", NULL};
+  char * value;
+  char * end;
+  long dlc;
+
+  while (*spec) {
+    switch (getsubopt(&spec, keys, &value)) {
+      case RATE:
+        if (!value || (gen->rate = strtod(value, &end)) <= 0 || *end) return -1;
+        break;
+      case ID:
+        if (!value || canlog_parse_id(value, &end, &gen->id_lo) < 0) return -1;
+        gen->id_hi = gen->id_lo;
+        if (*end == '-' && canlog_parse_id(end + 1, &end, &gen->id_hi) < 0) return -1;
+        if (*end) return -1;
+
+        /* a range is extended if either end is written as an extended id */
+        gen->eff = (gen->id_lo | gen->id_hi) & CAN_EFF_FLAG ? 1 : 0;
+        gen->id_lo &= CAN_EFF_MASK;
+        gen->id_hi &= CAN_EFF_MASK;
+        if (gen->id_hi < gen->id_lo) return -1;
+        break;
+      case DIST:
+        if (!value || (strcmp(value, "seq") && strcmp(value, "rand"))) return -1;
+        gen->id_rand = !strcmp(value, "rand");
+        break;
+      case DLC:
+        if (!value) return -1;
+        if (!strcmp(value, "rand")) {
+          gen->dlc = -1;
+          break;
+        }
+        dlc = strtol(value, &end, 10);
+        if (end == value || *end || dlc < 0 || dlc > CAN_MAX_DLEN) return -1;
+        gen->dlc = dlc;
+        break;
+      case DATA:
+        if (!value) return -1;
+        if (!strcmp(value, "inc")) {
+          gen->data = GEN_DATA_INC;
+        } else if (!strcmp(value, "rand")) {
+          gen->data = GEN_DATA_RAND;
+        } else {
+          gen->data = GEN_DATA_FIXED;
+          if (gen_parse_hex(value, &gen->fixed) < 0) return -1;
+        }
+        break;
+      case COUNT:
+        if (!value) return -1;
+        gen->limit = strtoull(value, &end, 10);
+        if (*end) return -1;
+        break;
+      case REPLAY:
+        if (!value || gen_load_replay(gen, value) < 0) return -1;
+        break;
+      case SPEED:
+        if (!value || (gen->speed = strtod(value, &end)) <= 0 || *end) return -1;
+        break;
+      default:
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+struct generator * generator_open(char * spec)
+{
+  struct generator * gen;
+
+  gen = calloc(1, sizeof(*gen));
+  if (!gen) return NULL;
+
+  gen->rate = 100;
+  gen->id_lo = gen->id_hi = 0x123;
+  gen->dlc = CAN_MAX_DLEN;
+  gen->speed = 1;
+  gen->rng = 0x12345678;
+  gen->src.fd = -1;
+
+  errno = 0;
+  if (gen_parse(gen, spec) < 0) {
+    if (!errno) errno = EINVAL;
+    goto err;
+  }
+
+  /* a fixed payload implies its length unless dlc= says otherwise */
+  if (gen->data == GEN_DATA_FIXED && gen->dlc == CAN_MAX_DLEN) gen->dlc = gen->fixed.len;
+
+  gen->src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (gen->src.fd < 0) goto err;
+  gen->src.cb = gen_tick;
+  gen->src.ctx = gen;
+  if (ev_add(&gen->src, EPOLLIN) < 0) goto err;
+
+  gen->start = now_ns() + GEN_MIN_TICK_NS;
+  gen->report_from = gen->start;
+  gen_arm(gen, gen->start);
+
+  if (gen->replay)
+    syslogger(
+      LOG_NOTICE, "generator replaying %zu frames at %.2fx speed\n", gen->replay_count,
+      gen->speed);
+  else
+    syslogger(LOG_NOTICE, "generator sending %.1f fps\n", gen->rate);
+
+  return gen;
+
+err:
+  if (gen->src.fd >= 0) close(gen->src.fd);
+  free(gen->replay);
+  free(gen);
+  return NULL;
+}
+
+void generator_close(struct generator * gen)
+{
+  if (!gen->done) gen_report(gen, now_ns(), "stopped");
+
+  ev_del(&gen->src);
+  close(gen->src.fd);
+  free(gen->replay);
+  free(gen);
+}
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * generator.h - paced CAN traffic generator for bus load testing
+ */
+
+#ifndef H_SLCAND_GENERATOR_H
+#define H_SLCAND_GENERATOR_H
+
+struct generator;
+
+/*
+ * Start generating frames on the shared transmit path as described by spec,
+ * a comma separated list of:
+ *
+ *   rate=<fps>          frames per second (default 100)
+ *   id=<hex>[-<hex>]    identifier or identifier range (default 123)
+ *   dist=seq|rand       walk the range in order or pick at random
+ *   dlc=<0..8>|rand     payload length (default 8)
+ *   data=inc|rand|<hex> counter, random or fixed payload (default inc)
+ *   count=<n>           stop after n frames (default unlimited)
+ *   replay=<file>       replay a candump log instead of a pattern
+ *   speed=<x>           replay speed factor (default 1)
+ *
+ * Identifiers with more than 3 digits are extended, as everywhere else. spec
+ * is modified while parsing.
+ */
+struct generator * generator_open(char * spec);
+void generator_close(struct generator * gen);
+
+#endif /* H_SLCAND_GENERATOR_H */
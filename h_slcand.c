@@ -26,6 +26,9 @@
 #include <asm-generic/termbits.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/can/netlink.h>
+#include <linux/ethtool.h>
 #include <linux/serial.h>
 #include <linux/sockios.h>
 #include <linux/tty.h>
@@ -40,11 +43,26 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <syslog.h>
 #include <unistd.h>
 
-/* Change this to whatever your daemon is called */
-#define DAEMON_NAME "h_slcand"
+#include "dialect.h"
+#include "evloop.h"
+#include "generator.h"
+#include "h_slcand.h"
+#include "netlink.h"
+#include "pdosync.h"
+#include "recorder.h"
+#include "rta.h"
+#include "rx.h"
+#include "server.h"
+#include "stats.h"
+#include "status.h"
+#include "trace.h"
+#include "tx.h"
+#include "uart.h"
+#include "vtty.h"
 
 /* Change this to the user under which to run */
 #define RUN_AS_USER "root"
@@ -57,6 +75,18 @@
 #define FLOW_HW 1
 #define FLOW_SW 2
 
+/* Maximum number of interfaces routed through kernel can-gw */
+#define MAX_GW_IFS 8
+
+/* Number of most recent spans the trace buffer keeps */
+#define TRACE_CAPACITY (1 << 18)
+
+/* Status page update interval unless -i is given */
+#define STATUS_DEFAULT_INTERVAL 100
+
+/* Default flight recorder window in seconds */
+#define REC_DEFAULT_WINDOW 10
+
 static void fake_syslog(int priority, const char * format, ...)
 {
   va_list ap;
@@ -68,8 +98,7 @@ static void fake_syslog(int priority, const char * format, ...)
   printf("\n");
 }
 
-typedef void (*syslog_t)(int priority, const char * format, ...);
-static syslog_t syslogger = syslog;
+syslog_t syslogger = syslog;
 
 void print_usage(char * prg)
 {
@@ -82,21 +111,55 @@ void print_usage(char * prg)
   fprintf(stderr, "         -l          (send listen only command 'L\\r', overrides -o)\n");
   fprintf(stderr, "         -s <speed>  (set CAN speed 0..8)\n");
   fprintf(stderr, "         -S <speed>  (set UART speed in baud)\n");
+  fprintf(stderr, "         -u          (probe UART rates within 2%% of -S, use the best one)\n");
   fprintf(stderr, "         -t <type>   (set UART flow control type 'hw' or 'sw')\n");
   fprintf(stderr, "         -b <btr>    (set bit time register value)\n");
+  fprintf(stderr, "         -g <canif>  (route to/from canif via kernel can-gw, repeatable)\n");
+  fprintf(stderr, "         -r <dir>    (keep a flight recorder, dump it to dir on trigger)\n");
+  fprintf(
+    stderr, "         -w <secs>   (flight recorder window, default %d)\n", REC_DEFAULT_WINDOW);
+  fprintf(stderr, "         -T <id#data> (dump recorder on this frame, repeatable)\n");
+  fprintf(stderr, "         -m <usecs>  (coalesce delivery to -r, -p, -V, -M by up to usecs,\n");
+  fprintf(stderr, "                      max %d)\n", RX_MAX_DELAY_US);
+  fprintf(stderr, "         -i <ms>     (poll netdevice and UART statistics every ms)\n");
+  fprintf(
+    stderr, "         -M          (publish a status page in /dev/shm/%s-<canif>,\n", DAEMON_NAME);
+  fprintf(
+    stderr, "                      updated every -i ms, default %d)\n", STATUS_DEFAULT_INTERVAL);
+  fprintf(stderr, "         -d <name>   (adapter dialect: auto, generic, panther, canable,\n");
+  fprintf(stderr, "                      usbtin or lawicel; default generic)\n");
+  fprintf(stderr, "         -A <file>   (analyse worst-case response times of the periodic\n");
+  fprintf(stderr, "                      messages in file for -S and -s, then exit)\n");
+  fprintf(stderr, "         -G <spec>   (generate paced test traffic, spec is key=value,... of\n");
+  fprintf(stderr, "                      rate, id, dist, dlc, data, count, replay and speed)\n");
+  fprintf(
+    stderr, "         -p <addr>   (serve socketcand clients on [host:]port, e.g. %d)\n",
+    SERVER_DEFAULT_PORT);
+  fprintf(stderr, "         -Y <ids>    (hold frames sent through -p, -V or -G with these comma\n");
+  fprintf(stderr, "                      separated hex ids until the next CANopen SYNC)\n");
+  fprintf(stderr, "         -V <link>   (share the adapter through a virtual SLCAN port,\n");
+  fprintf(stderr, "                      a pty symlinked at link, repeatable)\n");
+  fprintf(
+    stderr, "         -P <file>   (trace the event loop, write the last %d spans\n",
+    TRACE_CAPACITY);
+  fprintf(stderr, "                      as a Chrome trace at exit)\n");
   fprintf(stderr, "         -F          (stay in foreground; no daemonize)\n");
   fprintf(stderr, "         -h          (show this help page)\n");
   fprintf(stderr, "\nExamples:\n");
   fprintf(stderr, "h_slcand -o -c -f -s6 ttyUSB0\n\n");
   fprintf(stderr, "h_slcand -o -c -f -s6 ttyUSB0 can0\n\n");
   fprintf(stderr, "h_slcand -o -c -f -s6 /dev/ttyUSB0\n\n");
+  fprintf(stderr, "h_slcand -o -c -f -s6 -g vcan0 ttyUSB0 can0\n\n");
+  fprintf(stderr, "h_slcand -o -c -f -s6 -r /var/log/can -T 701#05 ttyUSB0 can0\n\n");
   exit(EXIT_FAILURE);
 }
 
-static int slcand_running;
+static volatile sig_atomic_t slcand_running;
 static volatile sig_atomic_t exit_code;
+static volatile sig_atomic_t dump_requested;
 static char ttypath[TTYPATH_LENGTH];
 
+/* Only sets flags, the main loop logs: syslog() is not async-signal-safe */
 static void child_handler(int signum)
 {
   switch (signum) {
@@ -108,11 +171,185 @@ static void child_handler(int signum)
     case SIGTERM:
     case SIGALRM:
     case SIGCHLD:
-      syslogger(LOG_NOTICE, "received signal %i on %s", signum, ttypath);
       exit_code = 128 + signum;
       slcand_running = 0;
       break;
+    case SIGUSR2:
+      dump_requested = 1;
+      break;
+  }
+}
+
+/* Attach the slcan line discipline and give the netdevice its requested name */
+static void attach_netdevice(int fd, struct ifreq * ifr, const char * name)
+{
+  int ldisc = N_SLCAN;
+
+  /* set slcan like discipline on given tty */
+  if (ioctl(fd, TIOCSETD, &ldisc) < 0) {
+    perror("ioctl TIOCSETD");
+    exit(EXIT_FAILURE);
+  }
+
+  /* retrieve the name of the created CAN netdevice */
+  if (ioctl(fd, SIOCGIFNAME, ifr->ifr_name) < 0) {
+    perror("ioctl SIOCGIFNAME");
+    exit(EXIT_FAILURE);
+  }
+
+  syslogger(LOG_NOTICE, "attached TTY %s to netdevice %s\n", ttypath, ifr->ifr_name);
+
+  /* try to rename the created netdevice */
+  if (name) {
+    int s = socket(PF_INET, SOCK_DGRAM, 0);
+
+    if (s < 0)
+      perror("socket for interface rename");
+    else {
+      /* current slcan%d name is still in ifr->ifr_name */
+      memset(ifr->ifr_newname, 0, sizeof(ifr->ifr_newname));
+      strncpy(ifr->ifr_newname, name, sizeof(ifr->ifr_newname) - 1);
+
+      if (ioctl(s, SIOCSIFNAME, ifr) < 0) {
+        syslogger(LOG_NOTICE, "netdevice %s rename to %s failed\n", ifr->ifr_name, name);
+        perror("ioctl SIOCSIFNAME rename");
+        exit(EXIT_FAILURE);
+      } else
+        syslogger(LOG_NOTICE, "netdevice %s renamed to %s\n", ifr->ifr_name, name);
+
+      close(s);
+    }
+  }
+}
+
+/*
+ * Make a path given on the command line absolute, as daemon() changes to /.
+ * Only the directory has to exist, the file itself may be created later.
+ */
+static char * absolute_path(const char * path)
+{
+  const char * base = strrchr(path, '/');
+  char dir[PATH_MAX];
+  char real[PATH_MAX];
+  char * abs;
+
+  if (!base)
+    snprintf(dir, sizeof(dir), ".");
+  else
+    snprintf(dir, sizeof(dir), "%.*s", base == path ? 1 : (int)(base - path), path);
+  base = base ? base + 1 : path;
+
+  if (!*base) {
+    errno = EISDIR;
+    return NULL;
   }
+  if (!realpath(dir, real)) return NULL;
+
+  abs = malloc(PATH_MAX);
+  if (!abs) return NULL;
+  if (snprintf(abs, PATH_MAX, "%s/%s", strcmp(real, "/") ? real : "", base) >= PATH_MAX) {
+    free(abs);
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  return abs;
+}
+
+/* Bitrates of the standard S0..S8 setup commands */
+static const unsigned int slcan_bitrates[] = {10000,  20000,  50000,  100000, 125000,
+                                              250000, 500000, 800000, 1000000};
+
+static int speed_to_bitrate(const char * speed)
+{
+  if (!speed) return 0;
+  if (speed[0] < '0' || speed[0] > '8') return -1;
+  return slcan_bitrates[speed[0] - '0'];
+}
+
+/* Since Linux 6.0 the slcan driver is a regular CAN netdevice sending S/F/O itself */
+static int kernel_has_slcan_netlink(void)
+{
+  struct utsname uts;
+
+  if (uname(&uts) < 0) return 0;
+  return atoi(uts.release) >= 6;
+}
+
+/* Set or clear an ethtool private flag of a netdevice */
+static int set_priv_flag(const char * ifname, const char * flag, int on)
+{
+  /* room for the one string set count the kernel appends, aligned for sset_mask */
+  union
+  {
+    struct ethtool_sset_info info;
+    char buf[sizeof(struct ethtool_sset_info) + sizeof(__u32)];
+  } sset;
+  struct ethtool_gstrings * strings = NULL;
+  struct ethtool_value val;
+  struct ifreq eifr;
+  unsigned int count, i;
+  int ret = -1;
+  int s;
+
+  s = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (s < 0) return -1;
+
+  memset(&eifr, 0, sizeof(eifr));
+  snprintf(eifr.ifr_name, sizeof(eifr.ifr_name), "%s", ifname);
+
+  memset(&sset, 0, sizeof(sset));
+  sset.info.cmd = ETHTOOL_GSSET_INFO;
+  sset.info.sset_mask = 1ULL << ETH_SS_PRIV_FLAGS;
+  eifr.ifr_data = (void *)&sset;
+  if (ioctl(s, SIOCETHTOOL, &eifr) < 0) goto out;
+  count = sset.info.sset_mask ? sset.info.data[0] : 0;
+
+  strings = calloc(1, sizeof(*strings) + count * ETH_GSTRING_LEN);
+  if (!strings) goto out;
+  strings->cmd = ETHTOOL_GSTRINGS;
+  strings->string_set = ETH_SS_PRIV_FLAGS;
+  strings->len = count;
+  eifr.ifr_data = (void *)strings;
+  if (ioctl(s, SIOCETHTOOL, &eifr) < 0) goto out;
+
+  for (i = 0; i < count; i++) {
+    if (!strncmp((char *)&strings->data[i * ETH_GSTRING_LEN], flag, ETH_GSTRING_LEN)) break;
+  }
+  if (i == count) {
+    errno = EOPNOTSUPP;
+    goto out;
+  }
+
+  val.cmd = ETHTOOL_GPFLAGS;
+  eifr.ifr_data = (void *)&val;
+  if (ioctl(s, SIOCETHTOOL, &eifr) < 0) goto out;
+
+  val.cmd = ETHTOOL_SPFLAGS;
+  val.data = on ? val.data | (1U << i) : val.data & ~(1U << i);
+  ret = ioctl(s, SIOCETHTOOL, &eifr);
+
+out:
+  free(strings);
+  close(s);
+  return ret;
+}
+
+/* Configure bitrate, listen-only and error reset through the in-kernel slcan driver */
+static int setup_netlink(
+  int nl, int ifindex, const char * ifname, const char * speed, int read_status_flags,
+  int listen)
+{
+  if (
+    nl_can_set(
+      nl, ifindex, speed_to_bitrate(speed), listen ? CAN_CTRLMODE_LISTENONLY : 0,
+      listen ? CAN_CTRLMODE_LISTENONLY : 0) < 0)
+    return -1;
+
+  if (read_status_flags && set_priv_flag(ifname, "err-rst-on-open", 1) < 0) return -1;
+
+  syslogger(
+    LOG_NOTICE, "netdevice %s configured through the in-kernel slcan driver\n", ifname);
+  return 0;
 }
 
 int main(int argc, char * argv[])
@@ -133,16 +370,50 @@ int main(int argc, char * argv[])
   char * speed = NULL;
   char * uart_speed_str = NULL;
   unsigned int uart_speed = 0;
+  unsigned int uart_actual;
+  int uart_probe_rates = 0;
   int flow_type = FLOW_NONE;
   char * btr = NULL;
   int run_as_daemon = 1;
   char * pch;
-  int ldisc = N_SLCAN;
+  int ldisc_tty = N_TTY;
+  int use_netlink;
+  struct slcan_setup setup;
+  const char * dialect_name = "generic";
+  const struct slcan_dialect * dialect = NULL;
+  char * rta_path = NULL;
+  char * trace_path = NULL;
+  char * gen_spec = NULL;
+  struct generator * gen = NULL;
+  char * server_addr = NULL;
+  struct server * srv = NULL;
+  char * pdosync_ids = NULL;
+  struct pdosync * ps = NULL;
+  char * vtty_links[VTTY_MAX_PORTS];
+  struct vtty * vttys[VTTY_MAX_PORTS];
+  int vtty_count = 0;
   int fd;
+  char * gw_ifs[MAX_GW_IFS];
+  int gw_ifindex[MAX_GW_IFS];
+  int gw_count = 0;
+  int slcan_ifindex = 0;
+  int nl = -1;
+  int i;
+  char * rec_dir = NULL;
+  unsigned int rec_window = REC_DEFAULT_WINDOW;
+  char * rec_triggers[REC_MAX_TRIGGERS];
+  int rec_trigger_count = 0;
+  struct recorder * rec = NULL;
+  unsigned long rx_max_delay = 0;
+  unsigned int stats_interval = 0;
+  struct stats * st = NULL;
+  int status_page = 0;
+  struct status * status = NULL;
+  char * ifname;
 
   ttypath[0] = '\0';
 
-  while ((opt = getopt(argc, argv, "ocfls:S:t:b:?hF")) != -1) {
+  while ((opt = getopt(argc, argv, "ocfls:S:ut:b:g:r:w:T:m:i:Md:A:P:G:p:Y:V:?hF")) != -1) {
     switch (opt) {
       case 'o':
         send_open = 1;
@@ -170,6 +441,9 @@ int main(int argc, char * argv[])
           exit(EXIT_FAILURE);
         }
         break;
+      case 'u':
+        uart_probe_rates = 1;
+        break;
       case 't':
         if (!strcmp(optarg, "hw")) {
           flow_type = FLOW_HW;
@@ -184,6 +458,73 @@ int main(int argc, char * argv[])
         btr = optarg;
         if (strlen(btr) > 8) print_usage(argv[0]);
         break;
+      case 'g':
+        if (gw_count == MAX_GW_IFS) {
+          fprintf(stderr, "Too many can-gw interfaces (max %d)\n", MAX_GW_IFS);
+          exit(EXIT_FAILURE);
+        }
+        gw_ifs[gw_count++] = optarg;
+        break;
+      case 'r':
+        rec_dir = optarg;
+        break;
+      case 'w':
+        rec_window = strtoul(optarg, NULL, 10);
+        if (!rec_window || rec_window > REC_MAX_WINDOW) {
+          fprintf(stderr, "Unsupported recorder window (%s)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'T':
+        if (rec_trigger_count == REC_MAX_TRIGGERS) {
+          fprintf(stderr, "Too many recorder triggers (max %d)\n", REC_MAX_TRIGGERS);
+          exit(EXIT_FAILURE);
+        }
+        rec_triggers[rec_trigger_count++] = optarg;
+        break;
+      case 'm':
+        rx_max_delay = strtoul(optarg, &pch, 10);
+        if (pch == optarg || *pch || rx_max_delay > RX_MAX_DELAY_US) {
+          fprintf(stderr, "Unsupported delivery delay (%s, max %d)\n", optarg, RX_MAX_DELAY_US);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'i':
+        stats_interval = strtoul(optarg, NULL, 10);
+        if (!stats_interval) print_usage(argv[0]);
+        break;
+      case 'M':
+        status_page = 1;
+        break;
+      case 'd':
+        dialect_name = optarg;
+        if (strcmp(optarg, "auto") && !dialect_find(optarg)) {
+          fprintf(stderr, "Unsupported adapter dialect (%s)\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'A':
+        rta_path = optarg;
+        break;
+      case 'P':
+        trace_path = optarg;
+        break;
+      case 'G':
+        gen_spec = optarg;
+        break;
+      case 'p':
+        server_addr = optarg;
+        break;
+      case 'Y':
+        pdosync_ids = optarg;
+        break;
+      case 'V':
+        if (vtty_count == VTTY_MAX_PORTS) {
+          fprintf(stderr, "Too many virtual SLCAN ports (max %d)\n", VTTY_MAX_PORTS);
+          exit(EXIT_FAILURE);
+        }
+        vtty_links[vtty_count++] = optarg;
+        break;
       case 'F':
         run_as_daemon = 0;
         break;
@@ -195,6 +536,50 @@ int main(int argc, char * argv[])
     }
   }
 
+  if (status_page && !stats_interval) stats_interval = STATUS_DEFAULT_INTERVAL;
+
+  if (uart_probe_rates && !uart_speed) {
+    fprintf(stderr, "UART rate probing (-u) needs -S\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Offline analysis does not touch the adapter */
+  if (rta_path) {
+    if (!uart_speed || speed_to_bitrate(speed) <= 0) {
+      fprintf(stderr, "Response-time analysis needs -S and -s\n");
+      exit(EXIT_FAILURE);
+    }
+    exit(rta_run(rta_path, uart_speed, speed_to_bitrate(speed)) ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
+  /* Resolve relative paths while the working directory is still ours */
+  if (rec_dir) {
+    pch = realpath(rec_dir, NULL);
+    if (!pch) {
+      fprintf(stderr, "Invalid recorder directory (%s): %s\n", rec_dir, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    rec_dir = pch;
+  }
+
+  if (trace_path) {
+    pch = absolute_path(trace_path);
+    if (!pch) {
+      fprintf(stderr, "Invalid trace file (%s): %s\n", trace_path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    trace_path = pch;
+  }
+
+  for (i = 0; i < vtty_count; i++) {
+    pch = absolute_path(vtty_links[i]);
+    if (!pch) {
+      fprintf(stderr, "Invalid virtual SLCAN port (%s): %s\n", vtty_links[i], strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    vtty_links[i] = pch;
+  }
+
   if (!run_as_daemon) syslogger = fake_syslog;
 
   /* Initialize the logging interface */
@@ -255,120 +640,261 @@ int main(int argc, char * argv[])
   tios.c_iflag &= ~IXOFF;
   tios.c_cflag &= ~CRTSCTS;
 
-  /* Baud Rate */
-  tios.c_cflag &= ~CBAUD;
-  tios.c_cflag |= BOTHER;
-  tios.c_ispeed = uart_speed;
-  tios.c_ospeed = uart_speed;
-
   /* Flow control */
   if (flow_type == FLOW_HW)
     tios.c_cflag |= CRTSCTS;
   else if (flow_type == FLOW_SW)
     tios.c_iflag |= (IXON | IXOFF);
 
-  /* apply changes */
-  if (ioctl(fd, TCSETS2, &tios) < 0) {
+  /* apply changes, the driver may only approximate the baud rate */
+  errno = 0;
+  if (uart_probe_rates)
+    uart_actual = uart_probe(fd, &tios, uart_speed);
+  else
+    uart_actual = uart_set_speed(fd, &tios, uart_speed);
+  if (!uart_actual && errno) {
     syslogger(LOG_NOTICE, "Cannot set attributes for device \"%s\": %s!\n", tty, strerror(errno));
     close(fd);
     exit(EXIT_FAILURE);
   }
 
-  if (speed) {
-    sprintf(buf, "C\rS%s\r", speed);
-    if (write(fd, buf, strlen(buf)) <= 0) {
-      perror("write");
-      exit(EXIT_FAILURE);
-    }
+  if (uart_speed && uart_actual != uart_speed)
+    syslogger(
+      LOG_NOTICE, "UART runs at %u baud, %+.2f%% off the requested %u\n", uart_actual,
+      100.0 * ((double)uart_actual - uart_speed) / uart_speed, uart_speed);
+
+  /* Resolve the adapter dialect once, everything after this follows it */
+  dialect = strcmp(dialect_name, "auto") ? dialect_find(dialect_name) : dialect_identify(fd);
+
+  setup.speed = speed;
+  setup.btr = btr;
+  setup.read_status_flags = send_read_status_flags;
+  setup.listen = send_listen;
+  setup.open = send_open;
+  dialect_restrict(dialect, &setup);
+  if (dialect->prepare) dialect->prepare(fd);
+
+  /* the in-kernel driver only sends S, F and O/L when it has a bitrate to set */
+  use_netlink = !setup.btr && speed_to_bitrate(speed) > 0 && kernel_has_slcan_netlink();
+  if (!use_netlink) send_setup_commands(fd, &setup);
+
+  attach_netdevice(fd, &ifr, name);
+
+  ifname = name ? name : ifr.ifr_name;
+  slcan_ifindex = if_nametoindex(ifname);
+  if (!slcan_ifindex) {
+    syslogger(LOG_NOTICE, "failed to find netdevice %s: %s\n", ifname, strerror(errno));
+    exit(EXIT_FAILURE);
   }
 
-  if (btr) {
-    sprintf(buf, "C\rs%s\r", btr);
-    if (write(fd, buf, strlen(buf)) <= 0) {
-      perror("write");
+  if (use_netlink || gw_count || stats_interval) {
+    nl = nl_open();
+    if (nl < 0) {
+      syslogger(LOG_NOTICE, "failed to open rtnetlink socket: %s\n", strerror(errno));
       exit(EXIT_FAILURE);
     }
   }
 
-  if (send_read_status_flags) {
-    sprintf(buf, "F\r");
-    if (write(fd, buf, strlen(buf)) <= 0) {
-      perror("write");
+  /* Let the in-kernel driver send the setup commands itself when the interface opens */
+  if (
+    use_netlink &&
+    setup_netlink(nl, slcan_ifindex, ifname, speed, setup.read_status_flags, send_listen) < 0) {
+    syslogger(
+      LOG_NOTICE, "in-kernel slcan setup failed (%s), falling back to serial commands\n",
+      strerror(errno));
+
+    if (ioctl(fd, TIOCSETD, &ldisc_tty) < 0) {
+      perror("ioctl TIOCSETD");
       exit(EXIT_FAILURE);
     }
-  }
 
-  if (send_listen) {
-    sprintf(buf, "L\r");
-    if (write(fd, buf, strlen(buf)) <= 0) {
-      perror("write");
+    send_setup_commands(fd, &setup);
+    attach_netdevice(fd, &ifr, name);
+
+    ifname = name ? name : ifr.ifr_name;
+    slcan_ifindex = if_nametoindex(ifname);
+    if (!slcan_ifindex) {
+      syslogger(LOG_NOTICE, "failed to find netdevice %s: %s\n", ifname, strerror(errno));
       exit(EXIT_FAILURE);
     }
-  } else if (send_open) {
-    sprintf(buf, "O\r");
-    if (write(fd, buf, strlen(buf)) <= 0) {
-      perror("write");
-      exit(EXIT_FAILURE);
+  }
+
+  /* Program kernel can-gw rules so plain forwarding never wakes us up */
+  if (gw_count) {
+    for (i = 0; i < gw_count; i++) {
+      gw_ifindex[i] = if_nametoindex(gw_ifs[i]);
+      if (!gw_ifindex[i]) {
+        syslogger(LOG_NOTICE, "unknown can-gw interface %s\n", gw_ifs[i]);
+        exit(EXIT_FAILURE);
+      }
+
+      if (
+        nl_cgw_add(nl, slcan_ifindex, gw_ifindex[i]) < 0 ||
+        nl_cgw_add(nl, gw_ifindex[i], slcan_ifindex) < 0) {
+        syslogger(LOG_NOTICE, "failed to add can-gw rule for %s: %s\n", gw_ifs[i], strerror(errno));
+        exit(EXIT_FAILURE);
+      }
+
+      syslogger(LOG_NOTICE, "kernel can-gw routing enabled between netdevice and %s\n", gw_ifs[i]);
     }
   }
 
-  /* set slcan like discipline on given tty */
-  if (ioctl(fd, TIOCSETD, &ldisc) < 0) {
-    perror("ioctl TIOCSETD");
+  if (ev_init() < 0) {
+    syslogger(LOG_ERR, "failed to create event loop: %s", strerror(errno));
     exit(EXIT_FAILURE);
   }
 
-  /* retrieve the name of the created CAN netdevice */
-  if (ioctl(fd, SIOCGIFNAME, ifr.ifr_name) < 0) {
-    perror("ioctl SIOCGIFNAME");
+  if (trace_path && trace_open(TRACE_CAPACITY) < 0) {
+    syslogger(LOG_ERR, "failed to allocate trace buffer: %s", strerror(errno));
     exit(EXIT_FAILURE);
   }
 
-  syslogger(LOG_NOTICE, "attached TTY %s to netdevice %s\n", ttypath, ifr.ifr_name);
-
-  /* try to rename the created netdevice */
-  if (name) {
-    int s = socket(PF_INET, SOCK_DGRAM, 0);
+  if (
+    (rec_dir || server_addr || vtty_count || status_page || pdosync_ids) &&
+    rx_open(slcan_ifindex) < 0) {
+    syslogger(LOG_ERR, "failed to open receive socket: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
 
-    if (s < 0)
-      perror("socket for interface rename");
-    else {
-      /* current slcan%d name is still in ifr.ifr_name */
-      memset(ifr.ifr_newname, 0, sizeof(ifr.ifr_newname));
-      strncpy(ifr.ifr_newname, name, sizeof(ifr.ifr_newname) - 1);
+  if (rec_dir) {
+    rec = recorder_open(ifname, rec_dir, rec_window, rx_max_delay);
+    if (!rec) {
+      syslogger(LOG_ERR, "failed to set up flight recorder: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
 
-      if (ioctl(s, SIOCSIFNAME, &ifr) < 0) {
-        syslogger(LOG_NOTICE, "netdevice %s rename to %s failed\n", buf, name);
-        perror("ioctl SIOCSIFNAME rename");
+    for (i = 0; i < rec_trigger_count; i++) {
+      if (recorder_add_trigger(rec, rec_triggers[i]) < 0) {
+        syslogger(LOG_ERR, "invalid recorder trigger %s", rec_triggers[i]);
         exit(EXIT_FAILURE);
-      } else
-        syslogger(LOG_NOTICE, "netdevice %s renamed to %s\n", buf, name);
+      }
+    }
+  }
 
-      close(s);
+  if ((server_addr || vtty_count || gen_spec || pdosync_ids) && tx_open(slcan_ifindex) < 0) {
+    syslogger(LOG_ERR, "failed to open transmit socket: %s", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (pdosync_ids) {
+    ps = pdosync_open(ifname, pdosync_ids);
+    if (!ps) {
+      syslogger(LOG_ERR, "failed to set up SYNC aligned release: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (server_addr) {
+    srv = server_open(ifname, server_addr, rx_max_delay);
+    if (!srv) {
+      syslogger(LOG_ERR, "failed to start socketcand server: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    server_recorder(srv, rec);
+  }
+
+  for (i = 0; i < vtty_count; i++) {
+    vttys[i] = vtty_open(vtty_links[i], rx_max_delay);
+    if (!vttys[i]) {
+      syslogger(
+        LOG_ERR, "failed to create virtual SLCAN port %s: %s", vtty_links[i], strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (stats_interval) {
+    st = stats_open(nl, slcan_ifindex, fd, stats_interval);
+    if (!st) {
+      syslogger(LOG_ERR, "failed to start statistics collection: %s", strerror(errno));
+      exit(EXIT_FAILURE);
     }
   }
 
-  /* Daemonize */
-  if (run_as_daemon) {
-    if (daemon(0, 0)) {
-      syslogger(LOG_ERR, "failed to daemonize");
+  if (status_page) {
+    status = status_open(ifname, st, stats_interval, uart_actual, rx_max_delay);
+    if (!status) {
+      syslogger(LOG_ERR, "failed to create status page: %s", strerror(errno));
       exit(EXIT_FAILURE);
     }
-  } else {
-    /* Trap signals that we expect to receive */
+  }
+
+  if (gen_spec) {
+    gen = generator_open(gen_spec);
+    if (!gen) {
+      syslogger(LOG_ERR, "failed to start generator: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* Daemonize, everything that can fail on the command line has been checked by now */
+  if (run_as_daemon && daemon(0, 0)) {
+    syslogger(LOG_ERR, "failed to daemonize");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Trap signals that we expect to receive, a daemon only if it has to clean up on exit */
+  slcand_running = 1;
+  if (!run_as_daemon || trace_path || status_page || vtty_count) {
     signal(SIGINT, child_handler);
     signal(SIGTERM, child_handler);
   }
 
-  slcand_running = 1;
+  /* Threads do not survive the fork in daemon(), so they start only now */
+  if (rec) {
+    if (recorder_start(rec) < 0) {
+      syslogger(LOG_ERR, "failed to start flight recorder: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    signal(SIGUSR2, child_handler);
+  }
 
   /* The Big Loop */
-  while (slcand_running) sleep(1); /* wait 1 second */
+  while (slcand_running) {
+    if (ev_run_once(1000) < 0) {
+      syslogger(LOG_ERR, "event loop failed: %s", strerror(errno));
+      break;
+    }
+
+    if (!slcand_running)
+      syslogger(LOG_NOTICE, "received signal %i on %s", exit_code - 128, ttypath);
+
+    if (dump_requested) {
+      dump_requested = 0;
+      recorder_trigger(rec, "signal");
+    }
+  }
+
+  if (gen) generator_close(gen);
+  if (st) stats_close(st);
+  rx_close();
+  if (rec) recorder_close(rec);
+  if (srv) server_close(srv);
+  if (ps) pdosync_close(ps);
+  for (i = 0; i < vtty_count; i++) vtty_close(vttys[i]);
+  if (status) status_close(status);
+  tx_close();
+  ev_close();
+
+  if (trace_path) {
+    if (trace_export(trace_path) < 0)
+      syslogger(LOG_NOTICE, "failed to write trace %s: %s\n", trace_path, strerror(errno));
+    else
+      syslogger(LOG_INFO, "trace written to %s\n", trace_path);
+  }
+
+  /* Remove can-gw rules (the kernel also drops them with the netdevice) */
+  for (i = 0; i < gw_count; i++) {
+    if (
+      nl_cgw_del(nl, slcan_ifindex, gw_ifindex[i]) < 0 ||
+      nl_cgw_del(nl, gw_ifindex[i], slcan_ifindex) < 0)
+      syslogger(
+        LOG_NOTICE, "failed to remove can-gw rule for %s: %s\n", gw_ifs[i], strerror(errno));
+  }
+  if (nl >= 0) close(nl);
 
   /* Reset line discipline */
   syslogger(LOG_INFO, "stopping on TTY device %s", ttypath);
-  ldisc = N_TTY;
-  if (ioctl(fd, TIOCSETD, &ldisc) < 0) {
+  if (ioctl(fd, TIOCSETD, &ldisc_tty) < 0) {
     perror("ioctl TIOCSETD");
     exit(EXIT_FAILURE);
   }
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * h_slcand.h - declarations shared between the h_slcand modules
+ */
+
+#ifndef H_SLCAND_H
+#define H_SLCAND_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Change this to whatever your daemon is called */
+#define DAEMON_NAME "h_slcand"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/* CLOCK_MONOTONIC in ns, the clock of all timers */
+static inline uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* syslog() in daemon mode, printf() based replacement in foreground mode */
+typedef void (*syslog_t)(int priority, const char * format, ...);
+extern syslog_t syslogger;
+
+#endif /* H_SLCAND_H */
@@ -0,0 +1,509 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * h_slcand_analyze.c - parallel offline analyzer for recorded CAN logs
+ *
+ * Reads candump compatible log files (as written by the h_slcand flight
+ * recorder or candump -l), memory-maps them and splits them at line
+ * boundaries across worker threads. Every worker parses its chunk with the
+ * daemon's log parser into private, mergeable statistics: per second bus
+ * load, per identifier counts and inter-arrival histograms, and error frame
+ * bursts. The main thread merges the results in chunk order.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/can.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "canlog.h"
+
+/* Inter-arrival histogram: bin n holds gaps of [2^(n-1), 2^n) microseconds */
+#define HIST_BINS 40
+
+/* Error frames closer than this belong to the same burst */
+#define BURST_GAP_US 100000
+
+/* Initial size of the per identifier hash table, must be a power of two */
+#define ID_TABLE_SIZE 1024
+
+struct id_stats
+{
+  canid_t id;
+  int used;
+  uint64_t count;
+  uint64_t first_us;
+  uint64_t last_us;
+  int has_gap;
+  uint64_t min_gap;
+  uint64_t max_gap;
+  uint32_t hist[HIST_BINS];
+};
+
+struct burst
+{
+  uint64_t start_us;
+  uint64_t end_us;
+  uint64_t frames;
+};
+
+struct chunk
+{
+  const char * start;
+  const char * end;
+  pthread_t thread;
+
+  uint64_t first_sec;
+  size_t seconds;
+  uint64_t * bits;
+
+  struct id_stats * ids;
+  size_t id_size;
+  size_t id_used;
+
+  struct burst * bursts;
+  size_t burst_count;
+  size_t burst_alloc;
+
+  uint64_t frames;
+  uint64_t errors;
+  uint64_t bad_lines;
+  int failed;
+};
+
+static void print_usage(char * prg)
+{
+  fprintf(stderr, "%s - parallel analyzer for recorded CAN logs.\n", prg);
+  fprintf(stderr, "\nUsage: %s [options] <logfile>\n\n", prg);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "         -b <bitrate> (CAN bitrate for bus load, default 1000000)\n");
+  fprintf(stderr, "         -j <threads> (worker threads, default: online CPUs)\n");
+  fprintf(stderr, "         -h           (show this help page)\n");
+  exit(EXIT_FAILURE);
+}
+
+static uint64_t tv_us(const struct timeval * tv)
+{
+  return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static int hist_bin(uint64_t us)
+{
+  int bin = us ? 64 - __builtin_clzll(us) : 0;
+
+  return bin < HIST_BINS ? bin : HIST_BINS - 1;
+}
+
+/* Nominal frame length in bits, excluding stuff bits */
+static unsigned int frame_bits(const struct can_frame * cf)
+{
+  unsigned int data = cf->can_id & CAN_RTR_FLAG ? 0 : 8 * cf->len;
+
+  return (cf->can_id & CAN_EFF_FLAG ? 67 : 47) + data;
+}
+
+static struct id_stats * id_lookup(struct id_stats * table, size_t size, canid_t id)
+{
+  size_t i = (id * 2654435761U) & (size - 1);
+
+  while (table[i].used && table[i].id != id) i = (i + 1) & (size - 1);
+  return &table[i];
+}
+
+static int id_grow(struct chunk * c)
+{
+  struct id_stats * old = c->ids;
+  size_t old_size = c->id_size;
+  size_t i;
+
+  c->id_size = old_size ? 2 * old_size : ID_TABLE_SIZE;
+  c->ids = calloc(c->id_size, sizeof(*c->ids));
+  if (!c->ids) return -1;
+
+  for (i = 0; i < old_size; i++) {
+    if (old[i].used) *id_lookup(c->ids, c->id_size, old[i].id) = old[i];
+  }
+  free(old);
+  return 0;
+}
+
+static void id_gap(struct id_stats * s, uint64_t gap)
+{
+  if (!s->has_gap || gap < s->min_gap) s->min_gap = gap;
+  if (gap > s->max_gap) s->max_gap = gap;
+  s->has_gap = 1;
+  s->hist[hist_bin(gap)]++;
+}
+
+static int chunk_frame(struct chunk * c, uint64_t us, const struct can_frame * cf)
+{
+  struct id_stats * s;
+  uint64_t sec = us / 1000000;
+  struct burst * b;
+
+  c->frames++;
+  if (sec >= c->first_sec && sec - c->first_sec < c->seconds)
+    c->bits[sec - c->first_sec] += frame_bits(cf);
+
+  if (cf->can_id & CAN_ERR_FLAG) {
+    c->errors++;
+    b = c->burst_count ? &c->bursts[c->burst_count - 1] : NULL;
+    if (b && us - b->end_us < BURST_GAP_US) {
+      b->end_us = us;
+      b->frames++;
+      return 0;
+    }
+
+    if (c->burst_count == c->burst_alloc) {
+      c->burst_alloc = c->burst_alloc ? 2 * c->burst_alloc : 64;
+      b = realloc(c->bursts, c->burst_alloc * sizeof(*b));
+      if (!b) return -1;
+      c->bursts = b;
+    }
+    b = &c->bursts[c->burst_count++];
+    b->start_us = b->end_us = us;
+    b->frames = 1;
+    return 0;
+  }
+
+  if (2 * (c->id_used + 1) > c->id_size && id_grow(c) < 0) return -1;
+
+  s = id_lookup(c->ids, c->id_size, cf->can_id);
+  if (!s->used) {
+    s->used = 1;
+    s->id = cf->can_id;
+    s->first_us = us;
+    c->id_used++;
+  } else {
+    id_gap(s, us - s->last_us);
+  }
+  s->count++;
+  s->last_us = us;
+  return 0;
+}
+
+static void * chunk_worker(void * arg)
+{
+  struct chunk * c = arg;
+  const char * p = c->start;
+  char line[CANLOG_LINE_LENGTH + 64];
+  struct timeval tv;
+  struct can_frame cf;
+  const char * nl;
+  size_t len;
+
+  while (p < c->end) {
+    nl = memchr(p, '\n', c->end - p);
+    len = (nl ? nl : c->end) - p;
+
+    /* the mapping is not NUL terminated, parse a bounded copy */
+    if (len < sizeof(line)) {
+      memcpy(line, p, len);
+      line[len] = '\0';
+      if (canlog_parse(line, &tv, NULL, &cf) < 0) {
+        c->bad_lines++;
+      } else if (chunk_frame(c, tv_us(&tv), &cf) < 0) {
+        c->failed = 1;
+        return NULL;
+      }
+    } else {
+      c->bad_lines++;
+    }
+
+    p += len + 1;
+  }
+
+  return NULL;
+}
+
+/* Timestamp of the first parsable line in [p, end), searching forward or backward */
+static int find_time(
+  const char * p, const char * end, const char * begin, int backward, uint64_t * us)
+{
+  char line[CANLOG_LINE_LENGTH + 64];
+  struct timeval tv;
+  struct can_frame cf;
+  const char * eol;
+  size_t len;
+
+  while (p >= begin && p < end) {
+    eol = memchr(p, '\n', end - p);
+    len = (eol ? eol : end) - p;
+    if (len < sizeof(line)) {
+      memcpy(line, p, len);
+      line[len] = '\0';
+      if (!canlog_parse(line, &tv, NULL, &cf)) {
+        *us = tv_us(&tv);
+        return 0;
+      }
+    }
+
+    if (!backward) {
+      p += len + 1;
+      continue;
+    }
+
+    /* step to the start of the previous line */
+    if (p == begin) break;
+    p -= 2;
+    while (p > begin && p[-1] != '\n') p--;
+  }
+
+  return -1;
+}
+
+static int cmp_ids(const void * a, const void * b)
+{
+  const struct id_stats * x = a;
+  const struct id_stats * y = b;
+
+  return (x->id > y->id) - (x->id < y->id);
+}
+
+/* The upper bound of the bin holding the percentile, but never more than the largest gap */
+static uint64_t hist_percentile(const struct id_stats * s, uint64_t total, double pct)
+{
+  uint64_t want = (uint64_t)(total * pct);
+  uint64_t seen = 0;
+  int i;
+
+  for (i = 0; i < HIST_BINS; i++) {
+    seen += s->hist[i];
+    if (seen > want) return !i ? 0 : 1ULL << i < s->max_gap ? 1ULL << i : s->max_gap;
+  }
+  return s->max_gap;
+}
+
+static void merge_ids(struct chunk * dst, struct chunk * src)
+{
+  size_t i;
+  int b;
+
+  for (i = 0; i < src->id_size; i++) {
+    struct id_stats * s = &src->ids[i];
+    struct id_stats * d;
+
+    if (!s->used) continue;
+
+    if (2 * (dst->id_used + 1) > dst->id_size && id_grow(dst) < 0) {
+      dst->failed = 1;
+      return;
+    }
+
+    d = id_lookup(dst->ids, dst->id_size, s->id);
+    if (!d->used) {
+      *d = *s;
+      dst->id_used++;
+      continue;
+    }
+
+    /* chunks are merged in order, so s follows d in time */
+    id_gap(d, s->first_us - d->last_us);
+    if (s->has_gap && s->min_gap < d->min_gap) d->min_gap = s->min_gap;
+    if (s->max_gap > d->max_gap) d->max_gap = s->max_gap;
+    for (b = 0; b < HIST_BINS; b++) d->hist[b] += s->hist[b];
+    d->count += s->count;
+    d->last_us = s->last_us;
+  }
+}
+
+static void report(struct chunk * all, uint64_t first_us, uint64_t last_us, unsigned int bitrate)
+{
+  struct burst longest = {0, 0, 0};
+  uint64_t peak = 0, total_bits = 0;
+  double span = (last_us - first_us) / 1e6;
+  struct id_stats * ids;
+  size_t i, n = 0;
+
+  for (i = 0; i < all->seconds; i++) {
+    total_bits += all->bits[i];
+    if (all->bits[i] > peak) peak = all->bits[i];
+  }
+  for (i = 0; i < all->burst_count; i++) {
+    if (all->bursts[i].frames > longest.frames) longest = all->bursts[i];
+  }
+
+  printf(
+    "frames:      %llu in %.3f s, %llu unparsable lines\n", (unsigned long long)all->frames, span,
+    (unsigned long long)all->bad_lines);
+  printf(
+    "bus load:    %.1f%% mean, %.1f%% peak second (nominal bits at %u bit/s)\n",
+    span > 0 ? 100.0 * total_bits / span / bitrate : 0, 100.0 * peak / bitrate, bitrate);
+  printf(
+    "errors:      %llu error frames in %zu bursts", (unsigned long long)all->errors,
+    all->burst_count);
+  if (longest.frames)
+    printf(
+      ", longest %llu frames over %.3f s", (unsigned long long)longest.frames,
+      (longest.end_us - longest.start_us) / 1e6);
+  printf("\n\n");
+
+  ids = malloc(all->id_used * sizeof(*ids));
+  if (!ids) return;
+  for (i = 0; i < all->id_size; i++) {
+    if (all->ids[i].used) ids[n++] = all->ids[i];
+  }
+  qsort(ids, n, sizeof(*ids), cmp_ids);
+
+  printf(
+    "%-8s %10s %10s %10s %10s %10s %10s\n", "id", "frames", "rate", "min gap", "p50 gap",
+    "p99 gap", "max gap");
+  for (i = 0; i < n; i++) {
+    struct id_stats * s = &ids[i];
+    uint64_t gaps = s->count - 1;
+
+    printf(s->id & CAN_EFF_FLAG ? "%08X" : "%-8X", s->id & CAN_EFF_MASK);
+    printf(" %10llu %8.1f/s", (unsigned long long)s->count, span > 0 ? s->count / span : 0);
+    if (gaps)
+      printf(
+        " %8.3fms %8.3fms %8.3fms %8.3fms\n", s->min_gap / 1e3,
+        hist_percentile(s, gaps, 0.5) / 1e3, hist_percentile(s, gaps, 0.99) / 1e3,
+        s->max_gap / 1e3);
+    else
+      printf("\n");
+  }
+  free(ids);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int bitrate = 1000000;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct chunk * chunks;
+  struct chunk * all;
+  uint64_t first_us, last_us;
+  const char * map;
+  struct stat st;
+  size_t i, j;
+  int opt;
+  int fd;
+
+  while ((opt = getopt(argc, argv, "b:j:h?")) != -1) {
+    switch (opt) {
+      case 'b':
+        bitrate = strtoul(optarg, NULL, 10);
+        if (!bitrate) print_usage(argv[0]);
+        break;
+      case 'j':
+        threads = strtol(optarg, NULL, 10);
+        if (threads < 1) print_usage(argv[0]);
+        break;
+      case 'h':
+      case '?':
+      default:
+        print_usage(argv[0]);
+        break;
+    }
+  }
+
+  if (!argv[optind]) print_usage(argv[0]);
+  if (threads < 1) threads = 1;
+
+  fd = open(argv[optind], O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+  if (!st.st_size) {
+    fprintf(stderr, "%s: empty log\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+  /* logs are chronological, so the first and last lines bound the time range */
+  if (
+    find_time(map, map + st.st_size, map, 0, &first_us) < 0 ||
+    find_time(map + st.st_size - 1, map + st.st_size, map, 1, &last_us) < 0) {
+    fprintf(stderr, "%s: no frames found\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  chunks = calloc(threads, sizeof(*chunks));
+  if (!chunks) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  /* split at line boundaries */
+  for (i = 0; i < (size_t)threads; i++) {
+    struct chunk * c = &chunks[i];
+    const char * p = map + st.st_size * i / threads;
+
+    if (i) {
+      while (p < map + st.st_size && p[-1] != '\n') p++;
+      chunks[i - 1].end = p;
+    }
+    c->start = p;
+    c->end = map + st.st_size;
+    c->first_sec = first_us / 1000000;
+    c->seconds = last_us / 1000000 - c->first_sec + 1;
+    c->bits = calloc(c->seconds, sizeof(*c->bits));
+    if (!c->bits || id_grow(c) < 0) {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (i = 0; i < (size_t)threads; i++) {
+    if (pthread_create(&chunks[i].thread, NULL, chunk_worker, &chunks[i])) {
+      fprintf(stderr, "failed to start worker thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* merge everything into the first chunk, in order */
+  all = &chunks[0];
+  pthread_join(all->thread, NULL);
+  for (i = 1; i < (size_t)threads; i++) {
+    struct chunk * c = &chunks[i];
+
+    pthread_join(c->thread, NULL);
+    all->failed |= c->failed;
+    all->frames += c->frames;
+    all->errors += c->errors;
+    all->bad_lines += c->bad_lines;
+    for (j = 0; j < all->seconds; j++) all->bits[j] += c->bits[j];
+    merge_ids(all, c);
+
+    for (j = 0; j < c->burst_count; j++) {
+      struct burst * last = all->burst_count ? &all->bursts[all->burst_count - 1] : NULL;
+      struct burst * b = &c->bursts[j];
+
+      if (last && b->start_us - last->end_us < BURST_GAP_US) {
+        last->end_us = b->end_us;
+        last->frames += b->frames;
+        continue;
+      }
+      if (all->burst_count == all->burst_alloc) {
+        all->burst_alloc = all->burst_alloc ? 2 * all->burst_alloc : 64;
+        all->bursts = realloc(all->bursts, all->burst_alloc * sizeof(*b));
+        if (!all->bursts) {
+          perror("realloc");
+          exit(EXIT_FAILURE);
+        }
+      }
+      all->bursts[all->burst_count++] = *b;
+    }
+  }
+
+  if (all->failed) {
+    fprintf(stderr, "out of memory while analysing %s\n", argv[optind]);
+    exit(EXIT_FAILURE);
+  }
+
+  report(all, first_us, last_us, bitrate);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * h_slcand_binmode.h - records of the h_slcand socketcand binmode extension
+ *
+ * A client of the -p server that sends "< binmode >" after opening the bus
+ * receives "< ok >" and from then on only these fixed size records, in host
+ * byte order, several per read while the bus is busy. Like any TCP stream a
+ * record may be split across reads. Commands from the client are still text.
+ *
+ * seq counts the frames the daemon received on the port. A gap means frames
+ * were lost on the way: in the daemon's socket, or because this client did
+ * not read fast enough. Frames the client sent itself are not echoed back
+ * and leave gaps as well.
+ */
+
+#ifndef H_SLCAND_BINMODE_H
+#define H_SLCAND_BINMODE_H
+
+#include <stdint.h>
+
+struct h_slcand_bin_frame
+{
+  /* kernel receive time (CLOCK_REALTIME) in microseconds */
+  uint64_t usec;
+
+  /* per-port receive sequence number, wraps around */
+  uint32_t seq;
+  uint32_t reserved;
+
+  /* identifier with the CAN_EFF_FLAG, CAN_RTR_FLAG and CAN_ERR_FLAG bits of <linux/can.h> */
+  uint32_t can_id;
+  uint8_t len;
+  uint8_t pad[3];
+  uint8_t data[8];
+};
+
+#endif /* H_SLCAND_BINMODE_H */
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * h_slcand_status.h - layout of the h_slcand status page
+ *
+ * With -M the daemon publishes the live state of its port in the shared
+ * memory object "/h_slcand-<canif>" (/dev/shm/h_slcand-<canif>). Monitors map
+ * it read-only once and copy it out with h_slcand_status_read(), without any
+ * system call and without waking the daemon:
+ *
+ *   int fd = shm_open("/h_slcand-can0", O_RDONLY, 0);
+ *   const struct h_slcand_status * page =
+ *     mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+ *   struct h_slcand_status now;
+ *
+ *   if (!h_slcand_status_read(page, &now)) ...
+ *
+ * The page is protected by a sequence lock: seq is odd while the daemon
+ * updates it. New fields are only ever appended; size is the length of the
+ * layout the daemon writes.
+ */
+
+#ifndef H_SLCAND_STATUS_H
+#define H_SLCAND_STATUS_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#define H_SLCAND_STATUS_MAGIC 0x534c4348 /* "HCLS" */
+#define H_SLCAND_STATUS_VERSION 1
+
+/* Attempts before a reader gives up on a page that stays locked */
+#define H_SLCAND_STATUS_SPINS 100000
+
+struct h_slcand_status
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  uint32_t seq;
+
+  /* CLOCK_REALTIME of the last update, and the update interval */
+  uint64_t updated_ns;
+  uint32_t interval_ms;
+
+  /* enum can_state of <linux/can/netlink.h>, from the error frames seen */
+  uint32_t can_state;
+
+  /* utilization over the last interval, UART in permille at 10 bits per byte */
+  uint32_t uart_baud;
+  uint32_t uart_rx_permille;
+  uint32_t uart_tx_permille;
+  uint32_t rx_fps;
+  uint32_t tx_fps;
+  uint32_t reserved0;
+
+  /* netdevice counters */
+  uint64_t rx_frames;
+  uint64_t tx_frames;
+  uint64_t rx_errors;
+  uint64_t tx_errors;
+  uint64_t rx_dropped;
+  uint64_t tx_dropped;
+
+  /* daemon receive path counters */
+  uint64_t rx_delivered;
+  uint64_t rx_socket_lost;
+  uint64_t rx_output_lost;
+
+  /* UART counters, zero if the serial driver has none */
+  uint32_t uart_overrun;
+  uint32_t uart_buf_overrun;
+  uint32_t uart_frame;
+  uint32_t uart_parity;
+
+  /* last error frame: receive time (CLOCK_REALTIME), can_id and data */
+  uint64_t last_error_ns;
+  uint32_t last_error_id;
+  uint8_t last_error_data[8];
+  uint32_t error_frames;
+
+  /* kernel receive timestamp to delivery in the daemon over the last interval */
+  uint32_t latency_p50_us;
+  uint32_t latency_p99_us;
+  uint32_t latency_max_us;
+  uint32_t reserved1;
+
+  /*
+   * Netdevice administratively up with carrier (IFF_UP and IFF_RUNNING), and
+   * its IF_OPER_* state of <linux/if.h>. Unlike can_state these do not rely
+   * on error frames, which the slcan driver only sends since Linux 6.0.
+   */
+  uint32_t link_up;
+  uint32_t operstate;
+};
+
+/*
+ * Copy a consistent snapshot of page to out, returns -1 (EPROTO) if the
+ * layout is unknown. Fields an older daemon does not write (out->size) read as zero.
+ * A daemon killed in the middle of an update leaves the page locked; after
+ * H_SLCAND_STATUS_SPINS attempts this fails with EAGAIN, back off and retry.
+ */
+static inline int h_slcand_status_read(
+  const struct h_slcand_status * page, struct h_slcand_status * out)
+{
+  size_t len = page->size < sizeof(*out) ? page->size : sizeof(*out);
+  uint32_t spins = 0;
+  uint32_t seq;
+
+  if (page->magic != H_SLCAND_STATUS_MAGIC || page->version != H_SLCAND_STATUS_VERSION) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  do {
+    do {
+      if (spins++ == H_SLCAND_STATUS_SPINS) {
+        errno = EAGAIN;
+        return -1;
+      }
+      seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+    } while (seq & 1);
+
+    memset(out, 0, sizeof(*out));
+    memcpy(out, page, len);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+
+  return 0;
+}
+
+#endif /* H_SLCAND_STATUS_H */
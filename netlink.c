@@ -0,0 +1,239 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * netlink.c - rtnetlink helpers used by h_slcand
+ */
+
+#include "netlink.h"
+
+#include <errno.h>
+#include <linux/can/gw.h>
+#include <linux/can/netlink.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Size of the request buffer, large enough for every message we build */
+#define NL_REQ_LENGTH 512
+
+/* Size of the reply buffer, large enough for a full RTM_NEWLINK dump */
+#define NL_REPLY_LENGTH 16384
+
+struct nl_req
+{
+  struct nlmsghdr nh;
+  char buf[NL_REQ_LENGTH];
+};
+
+static void * nl_tail(struct nlmsghdr * nh)
+{
+  return (char *)nh + NLMSG_ALIGN(nh->nlmsg_len);
+}
+
+static void nl_addattr(struct nlmsghdr * nh, unsigned short type, const void * data, size_t len)
+{
+  struct rtattr * rta = nl_tail(nh);
+
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(len);
+  if (len) memcpy(RTA_DATA(rta), data, len);
+  nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static struct rtattr * nl_nest_start(struct nlmsghdr * nh, unsigned short type)
+{
+  struct rtattr * nest = nl_tail(nh);
+
+  nl_addattr(nh, type, NULL, 0);
+  return nest;
+}
+
+static void nl_nest_end(struct nlmsghdr * nh, struct rtattr * nest)
+{
+  nest->rta_len = (char *)nl_tail(nh) - (char *)nest;
+}
+
+/* Sequence number of the last request sent */
+static __u32 nl_seq;
+
+/*
+ * Send a request and wait for its reply. Returns the first reply message of
+ * the given type, or NULL with errno set on failure (including a negative
+ * acknowledgement).
+ */
+static struct nlmsghdr * nl_request(
+  int nl, struct nlmsghdr * nh, int type, char * buf, size_t buflen)
+{
+  struct nlmsghdr * rh;
+  ssize_t len;
+
+  nh->nlmsg_flags |= NLM_F_REQUEST;
+  nh->nlmsg_seq = ++nl_seq;
+
+  if (send(nl, nh, nh->nlmsg_len, 0) < 0) return NULL;
+
+  do {
+    len = recv(nl, buf, buflen, 0);
+    if (len < 0) return NULL;
+
+    for (rh = (struct nlmsghdr *)buf; NLMSG_OK(rh, len); rh = NLMSG_NEXT(rh, len)) {
+      if (rh->nlmsg_seq != nh->nlmsg_seq) continue;
+
+      if (rh->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr * err = NLMSG_DATA(rh);
+
+        if (err->error) {
+          errno = -err->error;
+          return NULL;
+        }
+      }
+
+      if (rh->nlmsg_type == type) return rh;
+    }
+  } while (1);
+}
+
+/* Send a request and wait for its acknowledgement */
+static int nl_talk(int nl, struct nlmsghdr * nh)
+{
+  char buf[NL_REQ_LENGTH];
+
+  nh->nlmsg_flags |= NLM_F_ACK;
+  return nl_request(nl, nh, NLMSG_ERROR, buf, sizeof(buf)) ? 0 : -1;
+}
+
+int nl_open(void)
+{
+  struct sockaddr_nl sa;
+  int nl;
+
+  nl = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (nl < 0) return -1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.nl_family = AF_NETLINK;
+  if (bind(nl, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    close(nl);
+    return -1;
+  }
+
+  return nl;
+}
+
+static int nl_cgw(int nl, int type, int src_ifindex, int dst_ifindex)
+{
+  struct nl_req req;
+  struct nlmsghdr * nh = (struct nlmsghdr *)&req;
+  struct rtcanmsg * rtcan;
+  __u32 src = src_ifindex;
+  __u32 dst = dst_ifindex;
+
+  memset(&req, 0, sizeof(req));
+  nh->nlmsg_len = NLMSG_LENGTH(sizeof(*rtcan));
+  nh->nlmsg_type = type;
+
+  rtcan = NLMSG_DATA(nh);
+  rtcan->can_family = AF_CAN;
+  rtcan->gwtype = CGW_TYPE_CAN_CAN;
+  rtcan->flags = 0;
+
+  nl_addattr(nh, CGW_SRC_IF, &src, sizeof(src));
+  nl_addattr(nh, CGW_DST_IF, &dst, sizeof(dst));
+
+  return nl_talk(nl, nh);
+}
+
+int nl_cgw_add(int nl, int src_ifindex, int dst_ifindex)
+{
+  return nl_cgw(nl, RTM_NEWROUTE, src_ifindex, dst_ifindex);
+}
+
+int nl_cgw_del(int nl, int src_ifindex, int dst_ifindex)
+{
+  return nl_cgw(nl, RTM_DELROUTE, src_ifindex, dst_ifindex);
+}
+
+int nl_link_stats(
+  int nl, int ifindex, struct rtnl_link_stats64 * stats, unsigned int * flags,
+  unsigned int * operstate)
+{
+  static char buf[NL_REPLY_LENGTH];
+  struct nl_req req;
+  struct nlmsghdr * nh = (struct nlmsghdr *)&req;
+  struct ifinfomsg * ifi;
+  struct nlmsghdr * rh;
+  struct rtattr * rta;
+  int len, found = 0;
+
+  memset(&req, 0, sizeof(req));
+  nh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+  nh->nlmsg_type = RTM_GETLINK;
+
+  ifi = NLMSG_DATA(nh);
+  ifi->ifi_family = AF_UNSPEC;
+  ifi->ifi_index = ifindex;
+
+  rh = nl_request(nl, nh, RTM_NEWLINK, buf, sizeof(buf));
+  if (!rh) return -1;
+
+  *flags = ((struct ifinfomsg *)NLMSG_DATA(rh))->ifi_flags;
+  *operstate = IF_OPER_UNKNOWN;
+
+  len = IFLA_PAYLOAD(rh);
+  for (rta = IFLA_RTA(NLMSG_DATA(rh)); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+    if (rta->rta_type == IFLA_STATS64) {
+      memcpy(stats, RTA_DATA(rta), sizeof(*stats));
+      found = 1;
+    } else if (rta->rta_type == IFLA_OPERSTATE) {
+      *operstate = *(__u8 *)RTA_DATA(rta);
+    }
+  }
+
+  if (found) return 0;
+  errno = ENODATA;
+  return -1;
+}
+
+int nl_can_set(int nl, int ifindex, __u32 bitrate, __u32 ctrlmode_mask, __u32 ctrlmode_flags)
+{
+  struct nl_req req;
+  struct nlmsghdr * nh = (struct nlmsghdr *)&req;
+  struct ifinfomsg * ifi;
+  struct rtattr * linkinfo;
+  struct rtattr * data;
+
+  memset(&req, 0, sizeof(req));
+  nh->nlmsg_len = NLMSG_LENGTH(sizeof(*ifi));
+  nh->nlmsg_type = RTM_NEWLINK;
+
+  ifi = NLMSG_DATA(nh);
+  ifi->ifi_family = AF_UNSPEC;
+  ifi->ifi_index = ifindex;
+
+  linkinfo = nl_nest_start(nh, IFLA_LINKINFO);
+  nl_addattr(nh, IFLA_INFO_KIND, "can", strlen("can"));
+  data = nl_nest_start(nh, IFLA_INFO_DATA);
+
+  if (bitrate) {
+    struct can_bittiming bt;
+
+    memset(&bt, 0, sizeof(bt));
+    bt.bitrate = bitrate;
+    nl_addattr(nh, IFLA_CAN_BITTIMING, &bt, sizeof(bt));
+  }
+
+  if (ctrlmode_mask) {
+    struct can_ctrlmode cm;
+
+    cm.mask = ctrlmode_mask;
+    cm.flags = ctrlmode_flags;
+    nl_addattr(nh, IFLA_CAN_CTRLMODE, &cm, sizeof(cm));
+  }
+
+  nl_nest_end(nh, data);
+  nl_nest_end(nh, linkinfo);
+
+  return nl_talk(nl, nh);
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * netlink.h - rtnetlink helpers used by h_slcand
+ *
+ * All functions follow the syscall convention: they return a negative value
+ * on failure and leave the reason in errno.
+ */
+
+#ifndef H_SLCAND_NETLINK_H
+#define H_SLCAND_NETLINK_H
+
+#include <linux/if_link.h>
+
+/* Open a NETLINK_ROUTE socket */
+int nl_open(void);
+
+/* Add/remove a kernel can-gw rule forwarding every frame from src to dst */
+int nl_cgw_add(int nl, int src_ifindex, int dst_ifindex);
+int nl_cgw_del(int nl, int src_ifindex, int dst_ifindex);
+
+/* Read the IFLA_STATS64 counters, the IFF_* flags and the IF_OPER_* state of a netdevice */
+int nl_link_stats(
+  int nl, int ifindex, struct rtnl_link_stats64 * stats, unsigned int * flags,
+  unsigned int * operstate);
+
+/* Set the bitrate (if non-zero) and control mode bits of a CAN netdevice */
+int nl_can_set(int nl, int ifindex, __u32 bitrate, __u32 ctrlmode_mask, __u32 ctrlmode_flags);
+
+#endif /* H_SLCAND_NETLINK_H */
@@ -0,0 +1,168 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * pdosync.c - SYNC aligned release of CANopen RPDOs
+ *
+ * Frames with a configured identifier that any of the daemon's sources
+ * send (socketcand clients, their scheduled frames, virtual SLCAN ports and
+ * the generator) are not sent right away but parked in one slot per
+ * identifier, where a newer setpoint replaces an older one that has not been
+ * sent yet. When the receive path delivers a SYNC (seen on the bus, or sent
+ * by any local socket and looped back) all parked frames are sent as one
+ * batch in configuration order. The RPDOs then always follow the SYNC back
+ * to back instead of colliding with the TPDO burst of the drives at random
+ * moments. Programs writing to the netdevice themselves bypass the daemon
+ * and cannot be held.
+ *
+ * The SYNC has to be seen without delay, so this subscription disables
+ * receive coalescing for the whole daemon.
+ */
+
+#define _GNU_SOURCE
+
+#include "pdosync.h"
+
+#include <errno.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "canlog.h"
+#include "h_slcand.h"
+#include "rx.h"
+#include "tx.h"
+
+struct pdosync
+{
+  canid_t ids[PDOSYNC_MAX_IDS];
+  struct can_frame slots[PDOSYNC_MAX_IDS];
+  int full[PDOSYNC_MAX_IDS];
+  int count;
+
+  uint64_t cycles;
+  uint64_t sent;
+  uint64_t replaced;
+  uint64_t dropped;
+
+  struct can_frame frames[PDOSYNC_MAX_IDS];
+};
+
+static void pdosync_release(struct pdosync * ps)
+{
+  int i, n = 0, sent;
+
+  for (i = 0; i < ps->count; i++) {
+    if (!ps->full[i]) continue;
+    ps->frames[n++] = ps->slots[i];
+    ps->full[i] = 0;
+  }
+
+  ps->cycles++;
+  if (!n) return;
+
+  sent = tx_send_now(ps->frames, n);
+  ps->sent += sent;
+  ps->dropped += n - sent;
+}
+
+static void pdosync_rx(void * ctx, const struct rx_frame * frames, int n)
+{
+  struct pdosync * ps = ctx;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (frames[i].frame.can_id == PDOSYNC_SYNC_ID) pdosync_release(ps);
+  }
+}
+
+static int pdosync_hold(void * ctx, const struct can_frame * cf)
+{
+  struct pdosync * ps = ctx;
+  int i;
+
+  for (i = 0; i < ps->count; i++) {
+    if (ps->ids[i] != cf->can_id) continue;
+
+    if (ps->full[i]) ps->replaced++;
+    ps->slots[i] = *cf;
+    ps->full[i] = 1;
+    return 0;
+  }
+
+  return -1;
+}
+
+static int pdosync_parse(struct pdosync * ps, const char * ids)
+{
+  char * end;
+
+  do {
+    if (ps->count == PDOSYNC_MAX_IDS) return -1;
+    if (canlog_parse_id(ids, &end, &ps->ids[ps->count]) < 0 || (*end && *end != ',')) return -1;
+
+    ps->count++;
+    ids = end + 1;
+  } while (*end);
+
+  return 0;
+}
+
+/* The netdevice queue has to take a whole release at once */
+static void pdosync_check_queue(const struct pdosync * ps, const char * ifname)
+{
+  struct ifreq ifr;
+  int s;
+
+  s = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (s < 0) return;
+
+  memset(&ifr, 0, sizeof(ifr));
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+  if (!ioctl(s, SIOCGIFTXQLEN, &ifr) && ifr.ifr_qlen < ps->count)
+    syslogger(
+      LOG_WARNING,
+      "%d held identifiers exceed the %d frame transmit queue of %s, releases will drop "
+      "frames unless it is raised with 'ip link set %s txqueuelen %d'\n",
+      ps->count, ifr.ifr_qlen, ifname, ifname, ps->count);
+  close(s);
+}
+
+struct pdosync * pdosync_open(const char * ifname, const char * ids)
+{
+  struct pdosync * ps;
+
+  ps = calloc(1, sizeof(*ps));
+  if (!ps) return NULL;
+
+  if (pdosync_parse(ps, ids) < 0) {
+    errno = EINVAL;
+    goto err;
+  }
+
+  if (rx_subscribe(pdosync_rx, ps, 0) < 0) goto err;
+  tx_hold(pdosync_hold, ps);
+  pdosync_check_queue(ps, ifname);
+
+  syslogger(LOG_NOTICE, "holding %d RPDO identifiers until SYNC\n", ps->count);
+  return ps;
+
+err:
+  free(ps);
+  return NULL;
+}
+
+void pdosync_close(struct pdosync * ps)
+{
+  syslogger(
+    LOG_INFO, "SYNC release: %llu cycles, %llu frames sent, %llu replaced, %llu dropped\n",
+    (unsigned long long)ps->cycles, (unsigned long long)ps->sent,
+    (unsigned long long)ps->replaced, (unsigned long long)ps->dropped);
+
+  tx_hold(NULL, NULL);
+  free(ps);
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * pdosync.h - SYNC aligned release of CANopen RPDOs
+ */
+
+#ifndef H_SLCAND_PDOSYNC_H
+#define H_SLCAND_PDOSYNC_H
+
+#include <linux/can.h>
+
+/* Maximum number of held identifiers */
+#define PDOSYNC_MAX_IDS 32
+
+/* Default CANopen SYNC COB-ID */
+#define PDOSYNC_SYNC_ID 0x080
+
+struct pdosync;
+
+/*
+ * Hold back frames of the shared transmit path with the comma separated hex
+ * identifiers in ids until the next SYNC is received on the netdevice
+ * ifname, keeping only the latest frame per identifier, then send them.
+ */
+struct pdosync * pdosync_open(const char * ifname, const char * ids);
+void pdosync_close(struct pdosync * ps);
+
+#endif /* H_SLCAND_PDOSYNC_H */
@@ -0,0 +1,352 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * recorder.c - in-memory flight recorder with triggered dumps
+ *
+ * Frames seen on the netdevice (including error frames) are kept in a
+ * preallocated ring sized for the recording window at the highest classic
+ * CAN frame rate. A trigger copies the ring into a preallocated snapshot and
+ * wakes a background thread which writes it out as a candump log file. The
+ * file is written under a temporary name and renamed once complete, so
+ * readers never see partial dumps.
+ *
+ * Frame triggers are held off for one window after every dump. A bus that
+ * keeps reporting errors then produces back to back dumps covering each
+ * window once, instead of a dump per error frame.
+ */
+
+#include "recorder.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "canlog.h"
+#include "h_slcand.h"
+#include "rx.h"
+#include "trace.h"
+
+struct rec_trigger
+{
+  canid_t id;
+  canid_t mask;
+  unsigned char len;
+  unsigned char data[CAN_MAX_DLEN];
+};
+
+struct recorder
+{
+  char ifname[IFNAMSIZ];
+  char dir[PATH_MAX];
+  unsigned int window_s;
+
+  struct rec_trigger triggers[REC_MAX_TRIGGERS];
+  int trigger_count;
+
+  /* ring written by the event loop only */
+  struct rx_frame * ring;
+  size_t capacity;
+  size_t head;
+  size_t count;
+
+  /* snapshot handed over to the dump thread */
+  struct rx_frame * snap;
+  size_t snap_count;
+  struct timeval snap_time;
+  char reason[64];
+  uint32_t snap_lost;
+
+  pthread_t thread;
+  int started;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int dump_pending;
+  int stop;
+  unsigned long skipped;
+  unsigned long held_off;
+};
+
+static int recorder_write(struct recorder * rec, FILE * f)
+{
+  char line[CANLOG_LINE_LENGTH];
+  struct timeval cutoff;
+  struct rx_frame * prev = NULL;
+  size_t i;
+
+  cutoff = rec->snap_time;
+  cutoff.tv_sec -= rec->window_s;
+  rec->snap_lost = 0;
+
+  for (i = 0; i < rec->snap_count; i++) {
+    struct rx_frame * e = &rec->snap[i];
+
+    if (timercmp(&e->tv, &cutoff, <)) continue;
+
+    /* sequence gaps are frames lost before they reached the recorder */
+    if (prev) rec->snap_lost += e->seq - prev->seq - 1;
+    prev = e;
+    canlog_format(line, sizeof(line), &e->tv, rec->ifname, &e->frame);
+    if (fputs(line, f) == EOF) return -1;
+  }
+
+  if (fflush(f) == EOF) return -1;
+  return fsync(fileno(f));
+}
+
+static void recorder_dump(struct recorder * rec)
+{
+  char path[PATH_MAX + 96];
+  char tmppath[PATH_MAX + 100];
+  char stamp[16];
+  struct tm tm;
+  uint64_t begin = trace_now();
+  FILE * f;
+  int ret;
+
+  localtime_r(&rec->snap_time.tv_sec, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+  snprintf(
+    path, sizeof(path), "%s/%s-%s-%s.%06d.log", rec->dir, DAEMON_NAME, rec->ifname, stamp,
+    (int)rec->snap_time.tv_usec);
+  snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+
+  f = fopen(tmppath, "w");
+  if (!f) {
+    syslogger(LOG_NOTICE, "failed to create dump %s: %s\n", tmppath, strerror(errno));
+    return;
+  }
+
+  ret = recorder_write(rec, f);
+  if (fclose(f) == EOF) ret = -1;
+
+  if (ret < 0 || rename(tmppath, path) < 0) {
+    syslogger(LOG_NOTICE, "failed to write dump %s: %s\n", path, strerror(errno));
+    unlink(tmppath);
+    return;
+  }
+
+  trace_span(TRACE_DUMP_WRITE, begin, trace_now(), rec->snap_count);
+  syslogger(
+    LOG_NOTICE, "flight recorder dump (%s) written to %s, %u frames lost in window\n",
+    rec->reason, path, rec->snap_lost);
+}
+
+static void * recorder_thread(void * arg)
+{
+  struct recorder * rec = arg;
+
+  pthread_mutex_lock(&rec->lock);
+  for (;;) {
+    while (!rec->dump_pending && !rec->stop) pthread_cond_wait(&rec->cond, &rec->lock);
+    if (!rec->dump_pending) break;
+
+    /* the snapshot is ours until dump_pending is cleared */
+    pthread_mutex_unlock(&rec->lock);
+    recorder_dump(rec);
+    pthread_mutex_lock(&rec->lock);
+    rec->dump_pending = 0;
+  }
+  pthread_mutex_unlock(&rec->lock);
+
+  return NULL;
+}
+
+void recorder_trigger(struct recorder * rec, const char * reason)
+{
+  uint64_t begin;
+  size_t tail, first;
+
+  pthread_mutex_lock(&rec->lock);
+  if (rec->dump_pending) {
+    rec->skipped++;
+    pthread_mutex_unlock(&rec->lock);
+    return;
+  }
+  pthread_mutex_unlock(&rec->lock);
+
+  /* copy the ring oldest first; the dump thread is idle so no lock is needed */
+  begin = trace_enabled ? trace_now() : 0;
+  tail = (rec->head + rec->capacity - rec->count) % rec->capacity;
+  first = rec->capacity - tail < rec->count ? rec->capacity - tail : rec->count;
+  memcpy(rec->snap, &rec->ring[tail], first * sizeof(*rec->snap));
+  memcpy(&rec->snap[first], rec->ring, (rec->count - first) * sizeof(*rec->snap));
+  rec->snap_count = rec->count;
+  gettimeofday(&rec->snap_time, NULL);
+  snprintf(rec->reason, sizeof(rec->reason), "%s", reason);
+  if (trace_enabled) trace_span(TRACE_TRIGGER_COPY, begin, trace_now(), rec->count);
+
+  pthread_mutex_lock(&rec->lock);
+  rec->dump_pending = 1;
+  pthread_cond_signal(&rec->cond);
+  pthread_mutex_unlock(&rec->lock);
+}
+
+static const char * recorder_match(struct recorder * rec, const struct can_frame * cf)
+{
+  int i;
+
+  if (cf->can_id & CAN_ERR_FLAG) return cf->can_id & CAN_ERR_BUSOFF ? "bus-off" : "error frame";
+
+  for (i = 0; i < rec->trigger_count; i++) {
+    struct rec_trigger * t = &rec->triggers[i];
+
+    if ((cf->can_id & t->mask) != t->id) continue;
+    if (cf->len < t->len || memcmp(cf->data, t->data, t->len)) continue;
+    return "trigger frame";
+  }
+
+  return NULL;
+}
+
+/* The last dump already covers frames up to one window after it was taken */
+static int recorder_held_off(const struct recorder * rec, const struct timeval * tv)
+{
+  struct timeval until = rec->snap_time;
+
+  until.tv_sec += rec->window_s;
+  return timercmp(tv, &until, <);
+}
+
+static void recorder_rx(void * ctx, const struct rx_frame * frames, int n)
+{
+  struct recorder * rec = ctx;
+  uint64_t begin = trace_enabled ? trace_now() : 0;
+  const char * reason;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    rec->ring[rec->head] = frames[i];
+    rec->head = (rec->head + 1) % rec->capacity;
+    if (rec->count < rec->capacity) rec->count++;
+
+    reason = recorder_match(rec, &frames[i].frame);
+    if (!reason) continue;
+
+    if (recorder_held_off(rec, &frames[i].tv))
+      rec->held_off++;
+    else
+      recorder_trigger(rec, reason);
+  }
+
+  if (trace_enabled) trace_span(TRACE_RING_STORE, begin, trace_now(), n);
+}
+
+int recorder_add_trigger(struct recorder * rec, const char * spec)
+{
+  struct rec_trigger * t;
+  const char * p;
+  char * end;
+
+  if (rec->trigger_count == REC_MAX_TRIGGERS) {
+    errno = ENOSPC;
+    return -1;
+  }
+  t = &rec->triggers[rec->trigger_count];
+  memset(t, 0, sizeof(*t));
+
+  if (canlog_parse_id(spec, &end, &t->id) < 0 || (*end && *end != '#')) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (t->id & CAN_EFF_FLAG)
+    t->mask = CAN_EFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+  else
+    t->mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+
+  for (p = *end ? end + 1 : end; p[0] && p[1]; p += 2) {
+    char byte[3] = {p[0], p[1], '\0'};
+
+    if (t->len == CAN_MAX_DLEN) break;
+    t->data[t->len++] = strtoul(byte, &end, 16);
+    if (*end) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  if (*p) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rec->trigger_count++;
+  return 0;
+}
+
+struct recorder * recorder_open(
+  const char * ifname, const char * dir, unsigned int window_s, unsigned int max_delay_us)
+{
+  struct recorder * rec;
+
+  rec = calloc(1, sizeof(*rec));
+  if (!rec) return NULL;
+
+  snprintf(rec->ifname, sizeof(rec->ifname), "%s", ifname);
+  snprintf(rec->dir, sizeof(rec->dir), "%s", dir);
+  rec->window_s = window_s;
+  rec->capacity = (size_t)window_s * RX_MAX_FPS;
+
+  /* touch all pages now so recording never faults at runtime */
+  rec->ring = malloc(rec->capacity * sizeof(*rec->ring));
+  rec->snap = malloc(rec->capacity * sizeof(*rec->snap));
+  if (!rec->ring || !rec->snap) goto err_free;
+  memset(rec->ring, 0, rec->capacity * sizeof(*rec->ring));
+  memset(rec->snap, 0, rec->capacity * sizeof(*rec->snap));
+
+  pthread_mutex_init(&rec->lock, NULL);
+  pthread_cond_init(&rec->cond, NULL);
+
+  if (rx_subscribe(recorder_rx, rec, max_delay_us) < 0) {
+    recorder_close(rec);
+    return NULL;
+  }
+
+  return rec;
+
+err_free:
+  free(rec->ring);
+  free(rec->snap);
+  free(rec);
+  return NULL;
+}
+
+int recorder_start(struct recorder * rec)
+{
+  errno = pthread_create(&rec->thread, NULL, recorder_thread, rec);
+  if (errno) return -1;
+
+  rec->started = 1;
+  return 0;
+}
+
+void recorder_close(struct recorder * rec)
+{
+  if (rec->started) {
+    pthread_mutex_lock(&rec->lock);
+    rec->stop = 1;
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    pthread_join(rec->thread, NULL);
+  }
+
+  if (rec->skipped)
+    syslogger(LOG_INFO, "flight recorder skipped %lu triggers during dumps\n", rec->skipped);
+  if (rec->held_off)
+    syslogger(
+      LOG_INFO, "flight recorder held off %lu triggers within a window of a dump\n",
+      rec->held_off);
+
+  free(rec->ring);
+  free(rec->snap);
+  free(rec);
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * recorder.h - in-memory flight recorder with triggered dumps
+ */
+
+#ifndef H_SLCAND_RECORDER_H
+#define H_SLCAND_RECORDER_H
+
+/* Longest recording window in seconds */
+#define REC_MAX_WINDOW 60
+
+/* Maximum number of ID/payload triggers */
+#define REC_MAX_TRIGGERS 8
+
+struct recorder;
+
+/*
+ * Start recording the frames of the shared receive path; dumps go to dir as
+ * candump log files. Delivery may be held back up to max_delay_us.
+ */
+struct recorder * recorder_open(
+  const char * ifname, const char * dir, unsigned int window_s, unsigned int max_delay_us);
+void recorder_close(struct recorder * rec);
+
+/* Start the dump thread, only after the process has daemonized */
+int recorder_start(struct recorder * rec);
+
+/* Dump when a frame matches "<id>[#<data prefix>]" (hex, candump style) */
+int recorder_add_trigger(struct recorder * rec, const char * spec);
+
+/* Dump the last window to disk from the background thread */
+void recorder_trigger(struct recorder * rec, const char * reason);
+
+#endif /* H_SLCAND_RECORDER_H */
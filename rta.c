@@ -0,0 +1,368 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * rta.c - offline worst-case response-time analysis of periodic traffic
+ *
+ * Every message crosses two shared resources: the UART between host and
+ * adapter, and the CAN bus. Host to bus ("tx") messages first wait in the
+ * UART FIFO and are then queued for arbitration, bus to host ("rx") messages
+ * go the other way round. The UART link is full duplex, so each direction
+ * is its own FIFO. Lawicel-style adapters acknowledge every transmitted
+ * frame with "z\r" or "Z\r", so each tx message also puts two characters per
+ * period on the host bound direction.
+ *
+ * The CAN hop uses the classic fixed priority, non-preemptive analysis with
+ * worst-case bit stuffing and queuing jitter (Davis, Burns, Bril, Lukkien,
+ * "Controller Area Network (CAN) schedulability analysis: Refuted,
+ * revisited and revised", 2007). A FIFO hop is bounded by the length of its
+ * longest busy period. For tx messages the variation of the UART delay
+ * becomes release jitter of the CAN hop.
+ *
+ * The message set is read from a text file with one message per line:
+ *
+ *   <hex id> <dlc> <period ms> <deadline ms> [tx|rx] [jitter ms]
+ *
+ * Identifiers above 0x7FF or written with more than 3 digits are extended.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+
+#include "rta.h"
+
+#include <ctype.h>
+#include <linux/can.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "canlog.h"
+#include "h_slcand.h"
+
+/* Maximum number of messages in a set */
+#define RTA_MAX_MSGS 512
+
+/* Give up on a busy period once it exceeds this many longest periods */
+#define RTA_DIVERGENCE_FACTOR 1000
+
+/* UART characters are sent 8N1 */
+#define UART_BITS_PER_CHAR 10
+
+/* Acknowledgement of a transmitted frame: 'z' or 'Z' and the CR */
+#define UART_ACK_CHARS 2
+
+#define NSEC_PER_MSEC 1000000ULL
+
+struct rta_msg
+{
+  canid_t id;
+  int eff;
+  int dlc;
+  int rx;
+  uint64_t period;
+  uint64_t deadline;
+  uint64_t jitter;
+
+  /* derived, all in ns */
+  uint64_t prio;
+  uint64_t c_can;
+  uint64_t c_uart;
+  uint64_t c_ack;
+  uint64_t r_uart;
+  uint64_t r_can;
+  uint64_t total;
+};
+
+struct rta_set
+{
+  struct rta_msg msgs[RTA_MAX_MSGS];
+  int count;
+  uint64_t tau_bit;
+  uint64_t max_period;
+};
+
+static uint64_t div_ceil(uint64_t a, uint64_t b)
+{
+  return (a + b - 1) / b;
+}
+
+/* Lower value wins arbitration: 11 bit base id, then IDE, then the extension */
+static uint64_t arbitration_key(const struct rta_msg * m)
+{
+  if (!m->eff) return (uint64_t)m->id << 19;
+  return ((uint64_t)(m->id >> 18) << 19) | (1ULL << 18) | (m->id & 0x3FFFF);
+}
+
+/* Transmission time including worst-case stuffing and the 3 bit interframe space */
+static uint64_t can_time(const struct rta_msg * m, uint64_t tau_bit)
+{
+  unsigned int g = m->eff ? 54 : 34;
+  unsigned int bits = g + 8 * m->dlc + 13 + (g + 8 * m->dlc - 1) / 4;
+
+  return bits * tau_bit;
+}
+
+static uint64_t uart_chars_time(unsigned int chars, unsigned int baud)
+{
+  return div_ceil((uint64_t)chars * UART_BITS_PER_CHAR * NSEC_PER_SEC, baud);
+}
+
+/* SLCAN ASCII: type, id, dlc, two characters per byte and the CR */
+static uint64_t uart_time(const struct rta_msg * m, unsigned int baud)
+{
+  return uart_chars_time((m->eff ? 10 : 5) + 2 * m->dlc + 1, baud);
+}
+
+/* Release jitter of m at its UART hop; rx messages inherit it from the CAN hop */
+static uint64_t uart_jitter(const struct rta_msg * m)
+{
+  return m->rx ? m->jitter + m->r_can - m->c_can : m->jitter;
+}
+
+/* Characters m puts on one UART direction per period */
+static uint64_t uart_cost(const struct rta_msg * m, int rx)
+{
+  if (m->rx == rx) return m->c_uart;
+  return rx ? m->c_ack : 0;
+}
+
+/* Release jitter of the characters of m on one UART direction */
+static uint64_t uart_dir_jitter(const struct rta_msg * m, int rx)
+{
+  /* the ack follows the command once it is through the host to bus FIFO */
+  return m->rx == rx ? uart_jitter(m) : m->jitter + m->r_uart - m->c_uart;
+}
+
+/* Longest busy period of one UART direction; every job in it completes by its end */
+static uint64_t uart_busy_period(const struct rta_set * set, int rx)
+{
+  uint64_t t = 0;
+  uint64_t next;
+  int i;
+
+  for (i = 0; i < set->count; i++) t += uart_cost(&set->msgs[i], rx);
+
+  for (;;) {
+    next = 0;
+    for (i = 0; i < set->count; i++) {
+      const struct rta_msg * k = &set->msgs[i];
+
+      if (!uart_cost(k, rx)) continue;
+      if (k->r_can == UINT64_MAX) return UINT64_MAX;
+      next += div_ceil(t + uart_dir_jitter(k, rx), k->period) * uart_cost(k, rx);
+    }
+    if (next > RTA_DIVERGENCE_FACTOR * set->max_period) return UINT64_MAX;
+    if (next == t) return t;
+    t = next;
+  }
+}
+
+/* Release jitter of m at the CAN hop */
+static uint64_t can_jitter(const struct rta_msg * m)
+{
+  return m->rx ? m->jitter : m->jitter + m->r_uart - m->c_uart;
+}
+
+static uint64_t can_response(const struct rta_set * set, const struct rta_msg * m)
+{
+  uint64_t limit = RTA_DIVERGENCE_FACTOR * set->max_period;
+  uint64_t blocking = 0;
+  uint64_t busy, next, w, r, worst = 0;
+  uint64_t q, instances;
+  int i;
+
+  for (i = 0; i < set->count; i++) {
+    const struct rta_msg * k = &set->msgs[i];
+
+    if (k->prio > m->prio && k->c_can > blocking) blocking = k->c_can;
+  }
+
+  /* level-m busy period decides how many instances have to be checked */
+  busy = blocking + m->c_can;
+  for (;;) {
+    next = blocking;
+    for (i = 0; i < set->count; i++) {
+      const struct rta_msg * k = &set->msgs[i];
+
+      if (k->prio <= m->prio) next += div_ceil(busy + can_jitter(k), k->period) * k->c_can;
+    }
+    if (next > limit) return UINT64_MAX;
+    if (next == busy) break;
+    busy = next;
+  }
+
+  instances = div_ceil(busy + can_jitter(m), m->period);
+  for (q = 0; q < instances; q++) {
+    w = blocking + q * m->c_can;
+    for (;;) {
+      next = blocking + q * m->c_can;
+      for (i = 0; i < set->count; i++) {
+        const struct rta_msg * k = &set->msgs[i];
+
+        if (k->prio < m->prio)
+          next += div_ceil(w + can_jitter(k) + set->tau_bit, k->period) * k->c_can;
+      }
+      if (next > limit) return UINT64_MAX;
+      if (next == w) break;
+      w = next;
+    }
+
+    r = can_jitter(m) + w - q * m->period + m->c_can;
+    if (r > worst) worst = r;
+  }
+
+  return worst;
+}
+
+static int parse_ms(const char * s, uint64_t * ns)
+{
+  char * end;
+  double ms = strtod(s, &end);
+
+  if (end == s || *end || ms < 0) return -1;
+  *ns = (uint64_t)(ms * NSEC_PER_MSEC + 0.5);
+  return 0;
+}
+
+static int rta_load(struct rta_set * set, const char * path)
+{
+  char line[256];
+  char id[16], period[32], deadline[32], dir[8], jitter[32];
+  int lineno = 0;
+  char * end;
+  FILE * f;
+  int n, bad_id;
+
+  f = fopen(path, "r");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    struct rta_msg * m = &set->msgs[set->count];
+    char * p = line;
+
+    lineno++;
+    while (isspace((unsigned char)*p)) p++;
+    if (!*p || *p == '#') continue;
+
+    if (set->count == RTA_MAX_MSGS) {
+      fprintf(stderr, "%s: too many messages (max %d)\n", path, RTA_MAX_MSGS);
+      goto err;
+    }
+
+    memset(m, 0, sizeof(*m));
+    strcpy(dir, "tx");
+    strcpy(jitter, "0");
+    n = sscanf(p, "%15s %d %31s %31s %7s %31s", id, &m->dlc, period, deadline, dir, jitter);
+    bad_id = canlog_parse_id(id, &end, &m->id) < 0 || *end;
+    m->eff = m->id & CAN_EFF_FLAG ? 1 : 0;
+    m->id &= CAN_EFF_MASK;
+    m->rx = !strcmp(dir, "rx");
+    if (
+      n < 4 || bad_id || m->dlc < 0 || m->dlc > CAN_MAX_DLEN ||
+      parse_ms(period, &m->period) < 0 || !m->period || parse_ms(deadline, &m->deadline) < 0 ||
+      parse_ms(jitter, &m->jitter) < 0 || (strcmp(dir, "tx") && strcmp(dir, "rx"))) {
+      fprintf(stderr, "%s:%d: invalid message\n", path, lineno);
+      goto err;
+    }
+
+    if (m->period > set->max_period) set->max_period = m->period;
+    set->count++;
+  }
+
+  fclose(f);
+  return 0;
+
+err:
+  fclose(f);
+  return -1;
+}
+
+static void print_ms(uint64_t ns)
+{
+  if (ns == UINT64_MAX)
+    printf(" %10s", "unbounded");
+  else
+    printf(" %10.3f", (double)ns / NSEC_PER_MSEC);
+}
+
+int rta_run(const char * path, unsigned int uart_baud, unsigned int can_bitrate)
+{
+  struct rta_set * set;
+  uint64_t uart_busy;
+  double u_can = 0, u_uart[2] = {0, 0};
+  int violations = 0;
+  int i;
+
+  set = calloc(1, sizeof(*set));
+  if (!set || rta_load(set, path) < 0) {
+    free(set);
+    return -1;
+  }
+
+  set->tau_bit = NSEC_PER_SEC / can_bitrate;
+  for (i = 0; i < set->count; i++) {
+    struct rta_msg * m = &set->msgs[i];
+
+    m->prio = arbitration_key(m);
+    m->c_can = can_time(m, set->tau_bit);
+    m->c_uart = uart_time(m, uart_baud);
+    m->c_ack = m->rx ? 0 : uart_chars_time(UART_ACK_CHARS, uart_baud);
+    u_can += (double)m->c_can / m->period;
+    u_uart[m->rx] += (double)m->c_uart / m->period;
+    u_uart[1] += (double)m->c_ack / m->period;
+  }
+
+  /* host to bus UART, then the bus, then bus to host UART fed by the bus */
+  uart_busy = uart_busy_period(set, 0);
+  for (i = 0; i < set->count; i++) {
+    if (!set->msgs[i].rx) set->msgs[i].r_uart = uart_busy;
+  }
+
+  for (i = 0; i < set->count; i++) {
+    struct rta_msg * m = &set->msgs[i];
+
+    m->r_can = uart_busy == UINT64_MAX ? UINT64_MAX : can_response(set, m);
+  }
+
+  uart_busy = uart_busy_period(set, 1);
+  for (i = 0; i < set->count; i++) {
+    if (set->msgs[i].rx) set->msgs[i].r_uart = uart_busy;
+  }
+
+  printf(
+    "UART %u baud: tx %.1f%% rx %.1f%% utilization (with tx acks), CAN %u bit/s: %.1f%% "
+    "utilization\n\n",
+    uart_baud, 100 * u_uart[0], 100 * u_uart[1], can_bitrate, 100 * u_can);
+  printf(
+    "%-8s %3s %3s %10s %10s %10s %10s %10s\n", "id", "dlc", "dir", "period", "deadline", "uart",
+    "can", "response");
+
+  for (i = 0; i < set->count; i++) {
+    struct rta_msg * m = &set->msgs[i];
+
+    if (m->r_uart == UINT64_MAX || m->r_can == UINT64_MAX)
+      m->total = UINT64_MAX;
+    else if (m->rx)
+      m->total = m->r_can + m->r_uart;
+    else
+      m->total = m->c_uart + m->r_can;
+
+    printf(m->eff ? "%08X" : "%-8X", m->id);
+    printf(" %3d %3s", m->dlc, m->rx ? "rx" : "tx");
+    print_ms(m->period);
+    print_ms(m->deadline);
+    print_ms(m->r_uart);
+    print_ms(m->r_can);
+    print_ms(m->total);
+    if (m->total > m->deadline) {
+      printf("  DEADLINE MISS");
+      violations++;
+    }
+    printf("\n");
+  }
+
+  printf("\n%d of %d messages miss their deadline\n", violations, set->count);
+  free(set);
+  return violations ? 1 : 0;
+}
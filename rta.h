@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * rta.h - offline worst-case response-time analysis of periodic traffic
+ */
+
+#ifndef H_SLCAND_RTA_H
+#define H_SLCAND_RTA_H
+
+/*
+ * Analyse the message set in path for the given UART baud rate and CAN
+ * bitrate and print the results. Returns 0 when every deadline holds, 1 on
+ * a deadline violation and -1 when the message set cannot be read.
+ */
+int rta_run(const char * path, unsigned int uart_baud, unsigned int can_bitrate);
+
+#endif /* H_SLCAND_RTA_H */
@@ -0,0 +1,303 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * rx.c - shared receive path of the daemon's frame consumers
+ *
+ * All consumers share one CAN_RAW socket read in recvmmsg() batches.
+ * Delivery is moderated like NIC interrupts: while the bus is quiet every
+ * wakeup is delivered at once, but when a wakeup finds at least
+ * RX_COALESCE_FRAMES frames the socket is muted and drained from a timer
+ * instead, at most the smallest max_delay_us of all subscribers later. Once
+ * a timer drain comes back small the socket is watched directly again.
+ *
+ * The socket reports its own overflow drops (SO_RXQ_OVFL) with every frame;
+ * they are folded into the sequence numbers handed to the subscribers.
+ *
+ * Frames sent by any local socket, the daemon's own transmit path included,
+ * are looped back and flagged MSG_DONTROUTE. Outputs keep the frames they
+ * sent in a small set until the loopback shows up; anything else local,
+ * such as another client's frames, is passed on like bus traffic.
+ */
+
+#define _GNU_SOURCE
+
+#include "rx.h"
+
+#include <errno.h>
+#include <linux/can/raw.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "trace.h"
+
+/* Frames fetched per recvmmsg() */
+#define RX_BATCH 64
+
+/* Frames per wakeup above which delivery is coalesced */
+#define RX_COALESCE_FRAMES 8
+
+/* Maximum number of consumers */
+#define RX_MAX_SUBSCRIBERS 8
+
+/* The kernel's per frame receive buffer cost */
+#define RX_SKB_TRUESIZE 1024
+
+struct rx_subscriber
+{
+  rx_cb_t cb;
+  void * ctx;
+};
+
+static struct
+{
+  int sock;
+  struct ev_source sock_src;
+  struct ev_source timer_src;
+  unsigned int delay_us;
+  int moderated;
+  struct rx_counters counters;
+  uint32_t ovfl;
+
+  struct rx_subscriber subs[RX_MAX_SUBSCRIBERS];
+  int sub_count;
+
+  struct mmsghdr msgs[RX_BATCH];
+  struct iovec iov[RX_BATCH];
+  struct rx_frame frames[RX_BATCH];
+  char ctrl[RX_BATCH][CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(uint32_t))];
+} rx = {.sock = -1};
+
+/* Fill in timestamp and sequence number from the ancillary data */
+static void rx_tag(const struct msghdr * msg, struct rx_frame * f)
+{
+  struct cmsghdr * cmsg;
+  uint32_t ovfl = rx.ovfl;
+
+  f->tv.tv_sec = 0;
+  f->tv.tv_usec = 0;
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR((struct msghdr *)msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) continue;
+    if (cmsg->cmsg_type == SO_TIMESTAMP) memcpy(&f->tv, CMSG_DATA(cmsg), sizeof(f->tv));
+    if (cmsg->cmsg_type == SO_RXQ_OVFL) memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(ovfl));
+  }
+
+  rx.counters.socket_lost += (uint32_t)(ovfl - rx.ovfl);
+  rx.ovfl = ovfl;
+  f->seq = rx.counters.delivered++ + rx.counters.socket_lost;
+  f->flags = msg->msg_flags;
+}
+
+/* Emit the kernel receive to userspace queueing span of every frame of a batch */
+static void rx_trace(int n, uint64_t received)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    const struct timeval * tv = &rx.frames[i].tv;
+
+    trace_span(
+      TRACE_SOCKET_QUEUE, (uint64_t)tv->tv_sec * 1000000000ULL + tv->tv_usec * 1000ULL, received,
+      1);
+  }
+}
+
+/* Read and deliver everything queued, returns the number of frames */
+static int rx_drain(void)
+{
+  uint64_t begin, received = 0;
+  int total = 0;
+  int n, i;
+
+  do {
+    begin = trace_enabled ? trace_now() : 0;
+
+    for (i = 0; i < RX_BATCH; i++) {
+      rx.msgs[i].msg_hdr.msg_controllen = sizeof(rx.ctrl[i]);
+      rx.msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    n = recvmmsg(rx.sock, rx.msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+    if (trace_enabled) {
+      received = trace_now();
+      trace_span(TRACE_RECV_BATCH, begin, received, n > 0 ? n : 0);
+    }
+    if (n <= 0) break;
+
+    for (i = 0; i < n; i++) rx_tag(&rx.msgs[i].msg_hdr, &rx.frames[i]);
+    if (trace_enabled) rx_trace(n, received);
+
+    for (i = 0; i < rx.sub_count; i++) rx.subs[i].cb(rx.subs[i].ctx, rx.frames, n);
+    total += n;
+  } while (n == RX_BATCH);
+
+  return total;
+}
+
+static void rx_arm(unsigned int us)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = us / 1000000;
+  its.it_value.tv_nsec = (us % 1000000) * 1000L;
+  timerfd_settime(rx.timer_src.fd, 0, &its, NULL);
+}
+
+static void rx_moderate(int frames)
+{
+  int busy = rx.delay_us && frames >= RX_COALESCE_FRAMES;
+
+  if (busy) rx_arm(rx.delay_us);
+  if (busy == rx.moderated) return;
+
+  /* mute the socket while the timer drains it, watch it again once quiet */
+  rx.moderated = busy;
+  ev_mod(&rx.sock_src, busy ? 0 : EPOLLIN);
+}
+
+static void rx_readable(void * ctx, unsigned int events)
+{
+  (void)ctx;
+  (void)events;
+
+  rx_moderate(rx_drain());
+}
+
+static void rx_timer(void * ctx, unsigned int events)
+{
+  uint64_t expirations;
+
+  (void)ctx;
+  (void)events;
+
+  if (read(rx.timer_src.fd, &expirations, sizeof(expirations)) < 0) return;
+  rx_moderate(rx_drain());
+}
+
+int rx_open(int ifindex)
+{
+  struct sockaddr_can addr;
+  can_err_mask_t err_mask = CAN_ERR_MASK;
+  int on = 1;
+  int i;
+
+  for (i = 0; i < RX_BATCH; i++) {
+    rx.iov[i].iov_base = &rx.frames[i].frame;
+    rx.iov[i].iov_len = sizeof(rx.frames[i].frame);
+    rx.msgs[i].msg_hdr.msg_iov = &rx.iov[i];
+    rx.msgs[i].msg_hdr.msg_iovlen = 1;
+    rx.msgs[i].msg_hdr.msg_control = rx.ctrl[i];
+  }
+
+  rx.sock = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+  if (rx.sock < 0) return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifindex;
+  if (
+    setsockopt(rx.sock, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask)) < 0 ||
+    setsockopt(rx.sock, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0 ||
+    setsockopt(rx.sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0 ||
+    bind(rx.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    goto err_sock;
+
+  rx.timer_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (rx.timer_src.fd < 0) goto err_sock;
+  rx.timer_src.cb = rx_timer;
+
+  rx.sock_src.fd = rx.sock;
+  rx.sock_src.cb = rx_readable;
+  if (ev_add(&rx.sock_src, EPOLLIN) < 0 || ev_add(&rx.timer_src, EPOLLIN) < 0) goto err_timer;
+
+  return 0;
+
+err_timer:
+  close(rx.timer_src.fd);
+err_sock:
+  close(rx.sock);
+  rx.sock = -1;
+  return -1;
+}
+
+int rx_subscribe(rx_cb_t cb, void * ctx, unsigned int max_delay_us)
+{
+  socklen_t len = sizeof(int);
+  int rcvbuf, cur;
+
+  if (rx.sub_count == RX_MAX_SUBSCRIBERS) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  if (!rx.sub_count || max_delay_us < rx.delay_us) rx.delay_us = max_delay_us;
+  rx.subs[rx.sub_count].cb = cb;
+  rx.subs[rx.sub_count].ctx = ctx;
+  rx.sub_count++;
+
+  /* the socket has to hold everything arriving while delivery is held back */
+  rcvbuf = (int)((unsigned long long)RX_MAX_FPS * rx.delay_us / 1000000 * RX_SKB_TRUESIZE);
+  if (getsockopt(rx.sock, SOL_SOCKET, SO_RCVBUF, &cur, &len) < 0 || rcvbuf <= cur) return 0;
+  if (setsockopt(rx.sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+    setsockopt(rx.sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  return 0;
+}
+
+void rx_output_lost(unsigned int n)
+{
+  rx.counters.output_lost += n;
+}
+
+void rx_echo_sent(struct rx_echo * echo, const struct can_frame * cf)
+{
+  /* frames that never made it to the bus are forgotten eventually */
+  if (echo->count == RX_ECHO_DEPTH) {
+    echo->count--;
+    memmove(echo->frames, echo->frames + 1, echo->count * sizeof(*cf));
+  }
+  echo->frames[echo->count++] = *cf;
+}
+
+int rx_echo_match(struct rx_echo * echo, const struct rx_frame * f)
+{
+  const struct can_frame * cf = &f->frame;
+  int i;
+
+  if (!(f->flags & MSG_DONTROUTE)) return 0;
+
+  /* held and scheduled frames may loop back out of order */
+  for (i = 0; i < echo->count; i++) {
+    const struct can_frame * e = &echo->frames[i];
+
+    if (e->can_id != cf->can_id || e->len != cf->len || memcmp(e->data, cf->data, cf->len))
+      continue;
+
+    echo->count--;
+    memmove(&echo->frames[i], &echo->frames[i + 1], (echo->count - i) * sizeof(*e));
+    return 1;
+  }
+
+  return 0;
+}
+
+const struct rx_counters * rx_counters(void)
+{
+  return &rx.counters;
+}
+
+void rx_close(void)
+{
+  if (rx.sock < 0) return;
+
+  ev_del(&rx.sock_src);
+  ev_del(&rx.timer_src);
+  close(rx.timer_src.fd);
+  close(rx.sock);
+  rx.sock = -1;
+  rx.sub_count = 0;
+}
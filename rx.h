@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * rx.h - shared receive path of the daemon's frame consumers
+ */
+
+#ifndef H_SLCAND_RX_H
+#define H_SLCAND_RX_H
+
+#include <linux/can.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/* Shortest classic frames at 1 Mbit/s (47 bits incl. stuffing and IFS) */
+#define RX_MAX_FPS 22000
+
+/* Longest delivery delay a subscriber may ask for, in microseconds */
+#define RX_MAX_DELAY_US 100000
+
+/*
+ * A received frame with its kernel receive timestamp and per-port sequence
+ * number. Frames the socket had to drop still consume sequence numbers, so
+ * any later stage can spot losses as gaps. flags are the recvmsg() flags,
+ * MSG_DONTROUTE marks frames a local socket sent.
+ */
+struct rx_frame
+{
+  struct timeval tv;
+  uint32_t seq;
+  uint32_t flags;
+  struct can_frame frame;
+};
+
+/* Frames an output sent that have not looped back yet */
+#define RX_ECHO_DEPTH 64
+
+struct rx_echo
+{
+  struct can_frame frames[RX_ECHO_DEPTH];
+  int count;
+};
+
+/* Frame loss accounting of the userspace stages */
+struct rx_counters
+{
+  uint64_t delivered;
+  uint64_t socket_lost;
+  uint64_t output_lost;
+};
+
+/* Called with every batch of received frames, oldest first */
+typedef void (*rx_cb_t)(void * ctx, const struct rx_frame * frames, int n);
+
+/* Open the CAN_RAW socket on ifindex; error frames are received too */
+int rx_open(int ifindex);
+void rx_close(void);
+
+/*
+ * Deliver received frames to cb. max_delay_us bounds how long delivery may
+ * be held back to coalesce frames while the bus is busy; 0 never delays.
+ */
+int rx_subscribe(rx_cb_t cb, void * ctx, unsigned int max_delay_us);
+
+/* Outputs report frames they had to discard */
+void rx_output_lost(unsigned int n);
+
+/*
+ * Outputs that send frames themselves note them with rx_echo_sent(), and
+ * rx_echo_match() then recognises (and forgets) their loopback, so a client
+ * does not receive its own frames back as bus traffic.
+ */
+void rx_echo_sent(struct rx_echo * echo, const struct can_frame * cf);
+int rx_echo_match(struct rx_echo * echo, const struct rx_frame * f);
+
+const struct rx_counters * rx_counters(void);
+
+#endif /* H_SLCAND_RX_H */
@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * sched.c - launch time scheduled transmission
+ *
+ * Clients hand over frames together with an absolute CLOCK_MONOTONIC launch
+ * time. Pending frames are kept in a binary min-heap ordered by launch time
+ * and submission sequence, and an absolute timerfd is always armed at the
+ * earliest one. Every wakeup sends all frames that are due in one batch to
+ * the slcan netdevice, whose line discipline writes them to the UART right
+ * away, so clients do not need precise wakeups of their own.
+ */
+
+#define _GNU_SOURCE
+
+#include "sched.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "h_slcand.h"
+#include "tx.h"
+
+/* Frames sent per wakeup and batch */
+#define SCHED_BATCH 64
+
+/* Frames sent later than this after their launch time are counted as late */
+#define SCHED_LATE_NS 200000ULL
+
+struct sched_entry
+{
+  uint64_t launch;
+  uint64_t seq;
+  struct can_frame frame;
+};
+
+struct sched
+{
+  struct ev_source src;
+
+  struct sched_entry heap[SCHED_MAX_FRAMES];
+  size_t count;
+  uint64_t seq;
+
+  uint64_t sent;
+  uint64_t late;
+  uint64_t dropped;
+
+  struct can_frame frames[SCHED_BATCH];
+};
+
+static int sched_before(const struct sched_entry * a, const struct sched_entry * b)
+{
+  return a->launch < b->launch || (a->launch == b->launch && a->seq < b->seq);
+}
+
+static void sched_swap(struct sched * sched, size_t a, size_t b)
+{
+  struct sched_entry tmp = sched->heap[a];
+
+  sched->heap[a] = sched->heap[b];
+  sched->heap[b] = tmp;
+}
+
+static void sched_pop(struct sched * sched)
+{
+  size_t i = 0, child;
+
+  sched->heap[0] = sched->heap[--sched->count];
+  while ((child = 2 * i + 1) < sched->count) {
+    if (child + 1 < sched->count && sched_before(&sched->heap[child + 1], &sched->heap[child]))
+      child++;
+    if (!sched_before(&sched->heap[child], &sched->heap[i])) break;
+    sched_swap(sched, i, child);
+    i = child;
+  }
+}
+
+/* Arm the timer at the earliest launch time, or disarm it when nothing is pending */
+static void sched_arm(struct sched * sched)
+{
+  struct itimerspec its;
+  uint64_t at;
+
+  memset(&its, 0, sizeof(its));
+  if (sched->count) {
+    /* an all zero it_value would disarm the timer */
+    at = sched->heap[0].launch ? sched->heap[0].launch : 1;
+    its.it_value.tv_sec = at / NSEC_PER_SEC;
+    its.it_value.tv_nsec = at % NSEC_PER_SEC;
+  }
+  timerfd_settime(sched->src.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void sched_tick(void * ctx, unsigned int events)
+{
+  struct sched * sched = ctx;
+  uint64_t expirations;
+  uint64_t now;
+  int n, sent;
+
+  (void)events;
+
+  if (read(sched->src.fd, &expirations, sizeof(expirations)) < 0) return;
+
+  now = now_ns();
+  do {
+    for (n = 0; n < SCHED_BATCH && sched->count && sched->heap[0].launch <= now; n++) {
+      if (now - sched->heap[0].launch > SCHED_LATE_NS) sched->late++;
+      sched->frames[n] = sched->heap[0].frame;
+      sched_pop(sched);
+    }
+    if (!n) break;
+
+    sent = tx_send(sched->frames, n);
+    sched->sent += sent;
+    sched->dropped += n - sent;
+  } while (n == SCHED_BATCH);
+
+  sched_arm(sched);
+}
+
+int sched_submit(struct sched * sched, uint64_t launch_ns, const struct can_frame * cf)
+{
+  size_t i, parent;
+
+  if (sched->count == SCHED_MAX_FRAMES) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  i = sched->count++;
+  sched->heap[i].launch = launch_ns;
+  sched->heap[i].seq = sched->seq++;
+  sched->heap[i].frame = *cf;
+
+  while (i && sched_before(&sched->heap[i], &sched->heap[parent = (i - 1) / 2])) {
+    sched_swap(sched, i, parent);
+    i = parent;
+  }
+
+  if (!i) sched_arm(sched);
+  return 0;
+}
+
+struct sched * sched_open(void)
+{
+  struct sched * sched;
+
+  sched = calloc(1, sizeof(*sched));
+  if (!sched) return NULL;
+
+  sched->src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (sched->src.fd < 0) goto err;
+  sched->src.cb = sched_tick;
+  sched->src.ctx = sched;
+  if (ev_add(&sched->src, EPOLLIN) < 0) goto err;
+
+  /* the default 50 us timer slack would delay every launch */
+  prctl(PR_SET_TIMERSLACK, 1UL);
+
+  return sched;
+
+err:
+  if (sched->src.fd >= 0) close(sched->src.fd);
+  free(sched);
+  return NULL;
+}
+
+void sched_close(struct sched * sched)
+{
+  if (sched->sent || sched->count)
+    syslogger(
+      LOG_INFO, "scheduled tx: %llu frames sent, %llu late, %llu dropped, %zu still pending\n",
+      (unsigned long long)sched->sent, (unsigned long long)sched->late,
+      (unsigned long long)sched->dropped, sched->count);
+
+  ev_del(&sched->src);
+  close(sched->src.fd);
+  free(sched);
+}
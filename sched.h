@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * sched.h - launch time scheduled transmission
+ */
+
+#ifndef H_SLCAND_SCHED_H
+#define H_SLCAND_SCHED_H
+
+#include <linux/can.h>
+#include <stdint.h>
+
+/* Frames that can wait for their launch time at once */
+#define SCHED_MAX_FRAMES 1024
+
+struct sched;
+
+/* Send scheduled frames on the shared transmit path */
+struct sched * sched_open(void);
+void sched_close(struct sched * sched);
+
+/*
+ * Send cf at launch_ns (CLOCK_MONOTONIC). Frames due at the same time go out
+ * in submission order; frames already due are sent on the next wakeup.
+ * Fails with ENOSPC when SCHED_MAX_FRAMES frames are pending.
+ */
+int sched_submit(struct sched * sched, uint64_t launch_ns, const struct can_frame * cf);
+
+#endif /* H_SLCAND_SCHED_H */
@@ -0,0 +1,519 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * server.c - socketcand compatible frame server
+ *
+ * Speaks enough of the socketcand protocol for raw frame access: "open",
+ * "rawmode", "bcmmode", "send" and "echo". The "sendat" extension takes an
+ * absolute CLOCK_MONOTONIC launch time before the frame and hands it to the
+ * launch time scheduler. Received frames are formatted
+ * straight from the shared receive path into a per client output buffer, so
+ * a whole receive batch costs one send() per client. The "binmode" extension
+ * replaces the text frames with the fixed size binary records of
+ * h_slcand_binmode.h for high rates. "dump" triggers the flight recorder,
+ * if one is registered.
+ *
+ * Clients are never waited for: frames that do not fit into a client's
+ * output buffer are discarded and reported as output losses. Like with
+ * socketcand, a client does not receive the frames it sent itself.
+ */
+
+#define _GNU_SOURCE
+
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/can.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "canlog.h"
+#include "evloop.h"
+#include "h_slcand.h"
+#include "h_slcand_binmode.h"
+#include "recorder.h"
+#include "rx.h"
+#include "sched.h"
+#include "tx.h"
+
+/* Maximum number of connected clients */
+#define SERVER_MAX_CLIENTS 16
+
+/* Longest command accepted from a client */
+#define SERVER_IN_LENGTH 256
+
+/* Output buffered per client, about 1500 text frames */
+#define SERVER_OUT_LENGTH 65536
+
+enum client_mode
+{
+  CLIENT_NEW,
+  CLIENT_BCM,
+  CLIENT_RAW,
+  CLIENT_BIN,
+};
+
+struct client
+{
+  struct server * srv;
+  struct ev_source src;
+  enum client_mode mode;
+  char peer[INET_ADDRSTRLEN + 8];
+  unsigned long dropped;
+  struct rx_echo echo;
+
+  char in[SERVER_IN_LENGTH];
+  size_t in_len;
+
+  char out[SERVER_OUT_LENGTH];
+  size_t out_len;
+  int polling_out;
+};
+
+struct server
+{
+  char ifname[IFNAMSIZ];
+  struct sched * sched;
+  struct recorder * rec;
+  struct ev_source listen_src;
+  struct client * clients[SERVER_MAX_CLIENTS];
+};
+
+static void client_drop(struct client * c)
+{
+  struct server * srv = c->srv;
+  int i;
+
+  ev_del(&c->src);
+  close(c->src.fd);
+  syslogger(LOG_INFO, "client %s disconnected, %lu frames dropped\n", c->peer, c->dropped);
+
+  for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    if (srv->clients[i] == c) srv->clients[i] = NULL;
+  }
+  free(c);
+}
+
+/* Write out as much buffered output as the socket takes, returns -1 if the client is gone */
+static int client_flush(struct client * c)
+{
+  ssize_t n;
+  int want;
+
+  while (c->out_len) {
+    n = send(c->src.fd, c->out, c->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      return -1;
+    }
+    c->out_len -= n;
+    memmove(c->out, c->out + n, c->out_len);
+  }
+
+  want = c->out_len > 0;
+  if (want != c->polling_out) {
+    if (ev_mod(&c->src, EPOLLIN | (want ? EPOLLOUT : 0)) < 0) return -1;
+    c->polling_out = want;
+  }
+  return 0;
+}
+
+static int client_put(struct client * c, const void * data, size_t len)
+{
+  if (c->out_len + len > sizeof(c->out)) return -1;
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+  return 0;
+}
+
+static void client_reply(struct client * c, const char * fmt, ...)
+{
+  char buf[128];
+  va_list ap;
+  int len;
+
+  va_start(ap, fmt);
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len > 0 && (size_t)len < sizeof(buf)) client_put(c, buf, len);
+}
+
+static int client_put_frame(struct client * c, const struct rx_frame * f)
+{
+  const struct can_frame * cf = &f->frame;
+  char buf[64 + 2 * CAN_MAX_DLEN];
+  const char * fmt;
+  int len, i;
+
+  if (c->mode == CLIENT_BIN) {
+    struct h_slcand_bin_frame b;
+
+    memset(&b, 0, sizeof(b));
+    b.usec = (uint64_t)f->tv.tv_sec * 1000000 + f->tv.tv_usec;
+    b.seq = f->seq;
+    b.can_id = cf->can_id;
+    b.len = cf->len;
+    memcpy(b.data, cf->data, cf->len);
+    return client_put(c, &b, sizeof(b));
+  }
+
+  /* text mode has no representation for error frames */
+  if (cf->can_id & CAN_ERR_FLAG) return 0;
+
+  fmt = cf->can_id & CAN_EFF_FLAG ? "< frame %08X %ld.%06ld " : "< frame %03X %ld.%06ld ";
+  len = snprintf(
+    buf, sizeof(buf), fmt, cf->can_id & CAN_EFF_MASK, (long)f->tv.tv_sec, (long)f->tv.tv_usec);
+  for (i = 0; i < cf->len; i++) len += sprintf(buf + len, "%02X", cf->data[i]);
+  len += sprintf(buf + len, " >");
+
+  return client_put(c, buf, len);
+}
+
+/* Parse "<id> <dlc> <byte>..." as used by the send commands */
+static int parse_frame(char ** argv, int argc, struct can_frame * cf)
+{
+  unsigned long dlc, byte;
+  char * end;
+  int i;
+
+  memset(cf, 0, sizeof(*cf));
+  if (argc < 2) return -1;
+
+  if (canlog_parse_id(argv[0], &end, &cf->can_id) < 0 || *end) return -1;
+
+  dlc = strtoul(argv[1], &end, 10);
+  if (*end || dlc > CAN_MAX_DLEN || argc != 2 + (int)dlc) return -1;
+  cf->len = dlc;
+
+  for (i = 0; i < cf->len; i++) {
+    byte = strtoul(argv[2 + i], &end, 16);
+    if (*end || byte > 0xff) return -1;
+    cf->data[i] = byte;
+  }
+  return 0;
+}
+
+/* Parse a "<sec>.<fraction>" CLOCK_MONOTONIC time */
+static int parse_launch(const char * s, uint64_t * ns)
+{
+  unsigned long long sec;
+  uint64_t frac = 0;
+  char * end;
+  int digits = 0;
+
+  sec = strtoull(s, &end, 10);
+  if (end == s || (*end && *end != '.')) return -1;
+  if (*end) end++;
+  for (; *end >= '0' && *end <= '9'; end++) {
+    if (digits++ < 9) frac = frac * 10 + *end - '0';
+  }
+  for (; digits < 9; digits++) frac *= 10;
+
+  *ns = sec * 1000000000ULL + frac;
+  return *end ? -1 : 0;
+}
+
+static void client_send(struct client * c, char ** argv, int argc)
+{
+  struct can_frame cf;
+
+  if (parse_frame(argv + 1, argc - 1, &cf) < 0) {
+    client_reply(c, "< error invalid frame >");
+    return;
+  }
+
+  if (tx_send(&cf, 1) != 1) {
+    client_reply(c, "< error send failed >");
+    return;
+  }
+  rx_echo_sent(&c->echo, &cf);
+}
+
+static void client_sendat(struct client * c, char ** argv, int argc)
+{
+  struct can_frame cf;
+  uint64_t launch;
+
+  if (argc < 2 || parse_launch(argv[1], &launch) < 0 || parse_frame(argv + 2, argc - 2, &cf) < 0) {
+    client_reply(c, "< error invalid frame >");
+    return;
+  }
+
+  if (sched_submit(c->srv->sched, launch, &cf) < 0) {
+    client_reply(c, "< error schedule full >");
+    return;
+  }
+  rx_echo_sent(&c->echo, &cf);
+}
+
+static void client_dump(struct client * c)
+{
+  char reason[64];
+
+  if (!c->srv->rec) {
+    client_reply(c, "< error no flight recorder >");
+    return;
+  }
+
+  snprintf(reason, sizeof(reason), "client %s", c->peer);
+  recorder_trigger(c->srv->rec, reason);
+  client_reply(c, "< ok >");
+}
+
+static void client_command(struct client * c, char * cmd)
+{
+  char * argv[4 + CAN_MAX_DLEN + 1];
+  char * save;
+  int argc = 0;
+
+  for (argv[0] = strtok_r(cmd, " \t\r\n", &save); argv[argc] && argc < 4 + CAN_MAX_DLEN;)
+    argv[++argc] = strtok_r(NULL, " \t\r\n", &save);
+  if (!argc) return;
+
+  if (!strcmp(argv[0], "echo")) {
+    client_reply(c, "< echo >");
+  } else if (!strcmp(argv[0], "dump")) {
+    client_dump(c);
+  } else if (!strcmp(argv[0], "open")) {
+    if (c->mode != CLIENT_NEW || argc != 2 || strcmp(argv[1], c->srv->ifname)) {
+      client_reply(c, "< error could not open bus >");
+      return;
+    }
+    c->mode = CLIENT_BCM;
+    client_reply(c, "< ok >");
+  } else if (c->mode == CLIENT_NEW) {
+    client_reply(c, "< error no bus opened >");
+  } else if (!strcmp(argv[0], "rawmode")) {
+    c->mode = CLIENT_RAW;
+    client_reply(c, "< ok >");
+  } else if (!strcmp(argv[0], "bcmmode")) {
+    c->mode = CLIENT_BCM;
+    client_reply(c, "< ok >");
+  } else if (!strcmp(argv[0], "binmode")) {
+    client_reply(c, "< ok >");
+    c->mode = CLIENT_BIN;
+  } else if (!strcmp(argv[0], "send")) {
+    client_send(c, argv, argc);
+  } else if (!strcmp(argv[0], "sendat")) {
+    client_sendat(c, argv, argc);
+  } else {
+    client_reply(c, "< error unsupported command %.32s >", argv[0]);
+  }
+}
+
+/* Execute every complete "< ... >" command in the input buffer */
+static int client_parse(struct client * c)
+{
+  char * start;
+  char * end;
+  size_t used = 0;
+
+  while ((start = memchr(c->in + used, '<', c->in_len - used))) {
+    end = memchr(start, '>', c->in + c->in_len - start);
+    if (!end) break;
+
+    *end = '\0';
+    client_command(c, start + 1);
+    used = end + 1 - c->in;
+  }
+
+  if (!start) used = c->in_len;
+  c->in_len -= used;
+  memmove(c->in, c->in + used, c->in_len);
+
+  /* a command longer than the buffer can never complete */
+  return c->in_len == sizeof(c->in) ? -1 : 0;
+}
+
+static void client_event(void * ctx, unsigned int events)
+{
+  struct client * c = ctx;
+  ssize_t n;
+
+  if (events & EPOLLIN) {
+    n = recv(c->src.fd, c->in + c->in_len, sizeof(c->in) - c->in_len, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      client_drop(c);
+      return;
+    }
+    if (n > 0) {
+      c->in_len += n;
+      if (client_parse(c) < 0) {
+        client_drop(c);
+        return;
+      }
+    }
+  } else if (events & (EPOLLERR | EPOLLHUP)) {
+    client_drop(c);
+    return;
+  }
+
+  if (client_flush(c) < 0) client_drop(c);
+}
+
+static void server_accept(void * ctx, unsigned int events)
+{
+  struct server * srv = ctx;
+  struct sockaddr_in sa;
+  socklen_t salen = sizeof(sa);
+  struct client * c;
+  int fd, i, one = 1;
+
+  (void)events;
+
+  fd = accept4(srv->listen_src.fd, (struct sockaddr *)&sa, &salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) return;
+
+  for (i = 0; i < SERVER_MAX_CLIENTS && srv->clients[i]; i++)
+    ;
+  c = i < SERVER_MAX_CLIENTS ? calloc(1, sizeof(*c)) : NULL;
+  if (!c) {
+    syslogger(LOG_NOTICE, "rejecting client, %d clients connected\n", i);
+    close(fd);
+    return;
+  }
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  c->srv = srv;
+  c->src.fd = fd;
+  c->src.cb = client_event;
+  c->src.ctx = c;
+  inet_ntop(AF_INET, &sa.sin_addr, c->peer, INET_ADDRSTRLEN);
+  sprintf(c->peer + strlen(c->peer), ":%u", ntohs(sa.sin_port));
+
+  if (ev_add(&c->src, EPOLLIN) < 0) {
+    close(fd);
+    free(c);
+    return;
+  }
+  srv->clients[i] = c;
+  syslogger(LOG_INFO, "client %s connected\n", c->peer);
+
+  client_reply(c, "< hi >");
+  if (client_flush(c) < 0) client_drop(c);
+}
+
+static void server_rx(void * ctx, const struct rx_frame * frames, int n)
+{
+  struct server * srv = ctx;
+  struct client * c;
+  int i, j, lost;
+
+  for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    c = srv->clients[i];
+    if (!c || (c->mode != CLIENT_RAW && c->mode != CLIENT_BIN)) continue;
+
+    for (lost = 0, j = 0; j < n; j++) {
+      if (rx_echo_match(&c->echo, &frames[j])) continue;
+      if (client_put_frame(c, &frames[j]) < 0) lost++;
+    }
+    if (lost) {
+      c->dropped += lost;
+      rx_output_lost(lost);
+    }
+
+    if (client_flush(c) < 0) client_drop(c);
+  }
+}
+
+static int server_listen(const char * addr)
+{
+  struct sockaddr_in sa;
+  char host[INET_ADDRSTRLEN] = "127.0.0.1";
+  const char * port = addr;
+  const char * colon = strrchr(addr, ':');
+  unsigned long portnum;
+  char * end;
+  int fd, one = 1;
+
+  if (colon) {
+    if ((size_t)(colon - addr) >= sizeof(host)) goto inval;
+    memcpy(host, addr, colon - addr);
+    host[colon - addr] = '\0';
+    port = colon + 1;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  portnum = strtoul(port, &end, 10);
+  if (!*port || *end || portnum > 65535 || inet_pton(AF_INET, host, &sa.sin_addr) != 1) goto inval;
+  sa.sin_port = htons(portnum);
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, SERVER_MAX_CLIENTS) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+
+inval:
+  errno = EINVAL;
+  return -1;
+}
+
+struct server * server_open(const char * ifname, const char * addr, unsigned int max_delay_us)
+{
+  struct server * srv;
+
+  srv = calloc(1, sizeof(*srv));
+  if (!srv) return NULL;
+
+  snprintf(srv->ifname, sizeof(srv->ifname), "%s", ifname);
+  srv->listen_src.fd = -1;
+
+  srv->sched = sched_open();
+  if (!srv->sched) goto err;
+
+  srv->listen_src.fd = server_listen(addr);
+  if (srv->listen_src.fd < 0) goto err;
+  srv->listen_src.cb = server_accept;
+  srv->listen_src.ctx = srv;
+  if (ev_add(&srv->listen_src, EPOLLIN) < 0) goto err;
+
+  if (rx_subscribe(server_rx, srv, max_delay_us) < 0) {
+    server_close(srv);
+    return NULL;
+  }
+
+  syslogger(LOG_NOTICE, "socketcand server listening on %s\n", addr);
+  return srv;
+
+err:
+  if (srv->listen_src.fd >= 0) close(srv->listen_src.fd);
+  if (srv->sched) sched_close(srv->sched);
+  free(srv);
+  return NULL;
+}
+
+void server_recorder(struct server * srv, struct recorder * rec)
+{
+  srv->rec = rec;
+}
+
+void server_close(struct server * srv)
+{
+  int i;
+
+  for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    if (srv->clients[i]) client_drop(srv->clients[i]);
+  }
+
+  ev_del(&srv->listen_src);
+  close(srv->listen_src.fd);
+  sched_close(srv->sched);
+  free(srv);
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * server.h - socketcand compatible frame server
+ */
+
+#ifndef H_SLCAND_SERVER_H
+#define H_SLCAND_SERVER_H
+
+/* Default socketcand port */
+#define SERVER_DEFAULT_PORT 29536
+
+struct server;
+
+/*
+ * Listen on addr ("[host:]port", host defaults to 127.0.0.1) and serve the
+ * frames of the netdevice ifname to socketcand clients. Delivery is
+ * coalesced by up to max_delay_us while the bus is busy.
+ */
+struct server * server_open(const char * ifname, const char * addr, unsigned int max_delay_us);
+void server_close(struct server * srv);
+
+struct recorder;
+
+/* Let clients trigger a dump of rec with "< dump >" */
+void server_recorder(struct server * srv, struct recorder * rec);
+
+#endif /* H_SLCAND_SERVER_H */
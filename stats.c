@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * stats.c - periodic netdevice and tty statistics collection
+ *
+ * The slcan netdevice keeps its own packet, error and drop counters and the
+ * serial driver keeps UART level counters, so the N_SLCAN path can be
+ * observed without touching any frame: both are sampled from a timer on the
+ * event loop and turned into rates and deltas.
+ *
+ * Together with the counters of the daemon's own receive path they account
+ * for lost frames stage by stage: UART (overrun, framing, parity), line
+ * discipline (malformed or overflowing SLCAN input), netdevice (rx_dropped),
+ * daemon socket (SO_RXQ_OVFL) and daemon outputs.
+ */
+
+#include "stats.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "h_slcand.h"
+#include "netlink.h"
+#include "trace.h"
+
+/* Shortest interval between two debug lines with the rates */
+#define STATS_LOG_INTERVAL_NS NSEC_PER_SEC
+
+struct stats
+{
+  int nl;
+  int ifindex;
+  int tty_fd;
+  struct ev_source src;
+  struct port_stats cur;
+  struct port_stats first;
+  struct port_stats logged;
+  stats_cb_t cb;
+  void * ctx;
+};
+
+static double stats_rate(__u64 now, __u64 before, double dt)
+{
+  return dt > 0 ? (double)(now - before) / dt : 0;
+}
+
+static int64_t stats_elapsed_ns(const struct port_stats * prev, const struct port_stats * cur)
+{
+  return (int64_t)(cur->when.tv_sec - prev->when.tv_sec) * (int64_t)NSEC_PER_SEC +
+         (cur->when.tv_nsec - prev->when.tv_nsec);
+}
+
+/* Fill in the rates of cur over the time since prev */
+static void stats_rates(struct port_stats * cur, const struct port_stats * prev)
+{
+  double dt = stats_elapsed_ns(prev, cur) / 1e9;
+
+  cur->rx_fps = stats_rate(cur->link.rx_packets, prev->link.rx_packets, dt);
+  cur->tx_fps = stats_rate(cur->link.tx_packets, prev->link.tx_packets, dt);
+  cur->rx_bytes_ps = stats_rate(cur->link.rx_bytes, prev->link.rx_bytes, dt);
+  cur->tx_bytes_ps = stats_rate(cur->link.tx_bytes, prev->link.tx_bytes, dt);
+  if (cur->icount_valid && prev->icount_valid) {
+    cur->uart_rx_bytes_ps = stats_rate(cur->icount.rx, prev->icount.rx, dt);
+    cur->uart_tx_bytes_ps = stats_rate(cur->icount.tx, prev->icount.tx, dt);
+  }
+}
+
+/*
+ * With short sampling intervals (-M) a line per sample would flood the log,
+ * so the rates are logged averaged over at least STATS_LOG_INTERVAL_NS.
+ */
+static void stats_log_rates(struct stats * st)
+{
+  struct port_stats avg = st->cur;
+
+  if (stats_elapsed_ns(&st->logged, &avg) < (int64_t)STATS_LOG_INTERVAL_NS) return;
+
+  stats_rates(&avg, &st->logged);
+  syslogger(
+    LOG_DEBUG, "rx %.0f fps %.0f B/s, tx %.0f fps %.0f B/s, UART rx %.0f B/s tx %.0f B/s\n",
+    avg.rx_fps, avg.rx_bytes_ps, avg.tx_fps, avg.tx_bytes_ps, avg.uart_rx_bytes_ps,
+    avg.uart_tx_bytes_ps);
+  st->logged = st->cur;
+}
+
+/* Log error and drop counters which moved since the previous sample */
+static void stats_log_errors(const struct port_stats * prev, const struct port_stats * cur)
+{
+  const struct rtnl_link_stats64 * a = &prev->link;
+  const struct rtnl_link_stats64 * b = &cur->link;
+
+  if (
+    b->rx_errors != a->rx_errors || b->tx_errors != a->tx_errors ||
+    b->rx_dropped != a->rx_dropped || b->tx_dropped != a->tx_dropped ||
+    b->rx_over_errors != a->rx_over_errors)
+    syslogger(
+      LOG_NOTICE, "netdevice errors: rx +%llu tx +%llu, drops: rx +%llu tx +%llu, overrun +%llu\n",
+      (unsigned long long)(b->rx_errors - a->rx_errors),
+      (unsigned long long)(b->tx_errors - a->tx_errors),
+      (unsigned long long)(b->rx_dropped - a->rx_dropped),
+      (unsigned long long)(b->tx_dropped - a->tx_dropped),
+      (unsigned long long)(b->rx_over_errors - a->rx_over_errors));
+
+  if (
+    cur->rx.socket_lost != prev->rx.socket_lost || cur->rx.output_lost != prev->rx.output_lost)
+    syslogger(
+      LOG_NOTICE, "daemon drops: socket +%llu outputs +%llu\n",
+      (unsigned long long)(cur->rx.socket_lost - prev->rx.socket_lost),
+      (unsigned long long)(cur->rx.output_lost - prev->rx.output_lost));
+
+  if (!cur->icount_valid || !prev->icount_valid) return;
+
+  if (
+    cur->icount.frame != prev->icount.frame || cur->icount.overrun != prev->icount.overrun ||
+    cur->icount.buf_overrun != prev->icount.buf_overrun ||
+    cur->icount.parity != prev->icount.parity)
+    syslogger(
+      LOG_NOTICE, "UART errors: frame +%d overrun +%d buffer overrun +%d parity +%d\n",
+      cur->icount.frame - prev->icount.frame, cur->icount.overrun - prev->icount.overrun,
+      cur->icount.buf_overrun - prev->icount.buf_overrun,
+      cur->icount.parity - prev->icount.parity);
+}
+
+static int stats_sample(struct stats * st, struct port_stats * ps)
+{
+  clock_gettime(CLOCK_MONOTONIC, &ps->when);
+
+  if (nl_link_stats(st->nl, st->ifindex, &ps->link, &ps->if_flags, &ps->operstate) < 0)
+    return -1;
+
+  /* not every serial driver implements the icount counters */
+  if (st->tty_fd >= 0 && ioctl(st->tty_fd, TIOCGICOUNT, &ps->icount) < 0) st->tty_fd = -1;
+  ps->icount_valid = st->tty_fd >= 0;
+  ps->rx = *rx_counters();
+
+  return 0;
+}
+
+static void stats_tick(void * ctx, unsigned int events)
+{
+  struct stats * st = ctx;
+  struct port_stats prev = st->cur;
+  struct port_stats * cur = &st->cur;
+  uint64_t expirations;
+  uint64_t begin;
+
+  (void)events;
+
+  if (read(st->src.fd, &expirations, sizeof(expirations)) < 0) return;
+
+  begin = trace_enabled ? trace_now() : 0;
+  if (stats_sample(st, cur) < 0) {
+    syslogger(LOG_NOTICE, "failed to read netdevice statistics: %s\n", strerror(errno));
+    *cur = prev;
+    return;
+  }
+
+  if (trace_enabled) trace_span(TRACE_STATS_SAMPLE, begin, trace_now(), 0);
+
+  stats_rates(cur, &prev);
+  stats_log_rates(st);
+  stats_log_errors(&prev, cur);
+
+  if (st->cb) st->cb(st->ctx, cur);
+}
+
+void stats_notify(struct stats * st, stats_cb_t cb, void * ctx)
+{
+  st->cb = cb;
+  st->ctx = ctx;
+}
+
+struct stats * stats_open(int nl, int ifindex, int tty_fd, unsigned int interval_ms)
+{
+  struct itimerspec its;
+  struct stats * st;
+
+  st = calloc(1, sizeof(*st));
+  if (!st) return NULL;
+
+  st->nl = nl;
+  st->ifindex = ifindex;
+  st->tty_fd = tty_fd;
+  if (stats_sample(st, &st->cur) < 0) goto err_free;
+  st->first = st->cur;
+  st->logged = st->cur;
+
+  st->src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (st->src.fd < 0) goto err_free;
+  st->src.cb = stats_tick;
+  st->src.ctx = st;
+
+  its.it_interval.tv_sec = interval_ms / 1000;
+  its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(st->src.fd, 0, &its, NULL) < 0 || ev_add(&st->src, EPOLLIN) < 0) {
+    close(st->src.fd);
+    goto err_free;
+  }
+
+  return st;
+
+err_free:
+  free(st);
+  return NULL;
+}
+
+/* Frames lost at each stage between the first and the last sample */
+static void stats_log_losses(const struct port_stats * a, const struct port_stats * b)
+{
+  unsigned int uart = 0;
+
+  if (a->icount_valid && b->icount_valid)
+    uart = (b->icount.overrun - a->icount.overrun) +
+           (b->icount.buf_overrun - a->icount.buf_overrun) +
+           (b->icount.frame - a->icount.frame) + (b->icount.parity - a->icount.parity);
+
+  syslogger(
+    LOG_INFO,
+    "rx losses by stage: UART %u%s, ldisc %llu, netdevice %llu, socket %llu, outputs %llu\n", uart,
+    b->icount_valid ? "" : " (n/a)", (unsigned long long)(b->link.rx_errors - a->link.rx_errors),
+    (unsigned long long)(b->link.rx_dropped - a->link.rx_dropped),
+    (unsigned long long)(b->rx.socket_lost - a->rx.socket_lost),
+    (unsigned long long)(b->rx.output_lost - a->rx.output_lost));
+}
+
+void stats_close(struct stats * st)
+{
+  const struct rtnl_link_stats64 * a = &st->first.link;
+  const struct rtnl_link_stats64 * b = &st->cur.link;
+
+  syslogger(
+    LOG_INFO, "netdevice totals: rx %llu tx %llu frames, errors rx %llu tx %llu, dropped rx %llu\n",
+    (unsigned long long)(b->rx_packets - a->rx_packets),
+    (unsigned long long)(b->tx_packets - a->tx_packets),
+    (unsigned long long)(b->rx_errors - a->rx_errors),
+    (unsigned long long)(b->tx_errors - a->tx_errors),
+    (unsigned long long)(b->rx_dropped - a->rx_dropped));
+  stats_log_losses(&st->first, &st->cur);
+
+  ev_del(&st->src);
+  close(st->src.fd);
+  free(st);
+}
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * stats.h - periodic netdevice and tty statistics collection
+ */
+
+#ifndef H_SLCAND_STATS_H
+#define H_SLCAND_STATS_H
+
+#include <linux/if_link.h>
+#include <linux/serial.h>
+#include <time.h>
+
+#include "rx.h"
+
+/* Counters of the attached port and rates over the last interval */
+struct port_stats
+{
+  struct timespec when;
+  struct rtnl_link_stats64 link;
+  unsigned int if_flags;
+  unsigned int operstate;
+  struct serial_icounter_struct icount;
+  int icount_valid;
+  struct rx_counters rx;
+
+  /* per second */
+  double rx_fps;
+  double tx_fps;
+  double rx_bytes_ps;
+  double tx_bytes_ps;
+  double uart_rx_bytes_ps;
+  double uart_tx_bytes_ps;
+};
+
+/* Called after every sample */
+typedef void (*stats_cb_t)(void * ctx, const struct port_stats * ps);
+
+struct stats;
+
+/*
+ * Poll IFLA_STATS64 and the link state of ifindex over nl and TIOCGICOUNT of
+ * tty_fd every interval
+ */
+struct stats * stats_open(int nl, int ifindex, int tty_fd, unsigned int interval_ms);
+void stats_close(struct stats * st);
+
+/* Register the one consumer of every sample */
+void stats_notify(struct stats * st, stats_cb_t cb, void * ctx);
+
+#endif /* H_SLCAND_STATS_H */
@@ -0,0 +1,230 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * status.c - memory-mapped status page of the port
+ *
+ * The page lives in a POSIX shared memory object that monitors map
+ * read-only. It is rewritten after every statistics sample under a sequence
+ * lock, so readers never see a torn update and never make the daemon do
+ * any work on their behalf. Error frames and receive latencies are taken
+ * from the shared receive path in between; latencies are kept in a log2
+ * histogram per interval, which is all the percentiles need.
+ */
+
+#include "status.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <linux/can/netlink.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "h_slcand.h"
+#include "h_slcand_status.h"
+#include "rx.h"
+
+/* Latency histogram: bin n holds [2^(n-1), 2^n) microseconds */
+#define STATUS_LATENCY_BINS 32
+
+struct status
+{
+  char name[IFNAMSIZ + 16];
+  struct h_slcand_status * page;
+  unsigned int uart_baud;
+
+  uint32_t latency[STATUS_LATENCY_BINS];
+  uint32_t latency_max;
+  uint32_t latency_count;
+  uint32_t can_state;
+  uint32_t error_frames;
+  uint64_t last_error_ns;
+  uint32_t last_error_id;
+  uint8_t last_error_data[CAN_MAX_DLEN];
+};
+
+static uint32_t status_percentile(const struct status * status, double pct)
+{
+  uint32_t want = status->latency_count * pct;
+  uint32_t seen = 0;
+  int i;
+
+  for (i = 0; i < STATUS_LATENCY_BINS; i++) {
+    seen += status->latency[i];
+    /* the bin's upper bound, but never more than was actually seen */
+    if (seen > want) {
+      if (!i) return 0;
+      return 1U << i < status->latency_max ? 1U << i : status->latency_max;
+    }
+  }
+  return status->latency_max;
+}
+
+/* Bus state as the error frames of the slcan driver report it */
+static uint32_t status_can_state(uint32_t state, const struct can_frame * cf)
+{
+  if (cf->can_id & CAN_ERR_BUSOFF) return CAN_STATE_BUS_OFF;
+  if (cf->can_id & CAN_ERR_RESTARTED) return CAN_STATE_ERROR_ACTIVE;
+  if (!(cf->can_id & CAN_ERR_CRTL)) return state;
+
+  if (cf->data[1] & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE))
+    return CAN_STATE_ERROR_PASSIVE;
+  if (cf->data[1] & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING))
+    return CAN_STATE_ERROR_WARNING;
+  if (cf->data[1] & CAN_ERR_CRTL_ACTIVE) return CAN_STATE_ERROR_ACTIVE;
+  return state;
+}
+
+static void status_rx(void * ctx, const struct rx_frame * frames, int n)
+{
+  struct status * status = ctx;
+  const struct rx_frame * f;
+  struct timeval now, lat;
+  uint32_t us;
+  int i, bin;
+
+  gettimeofday(&now, NULL);
+
+  for (i = 0; i < n; i++) {
+    f = &frames[i];
+
+    timersub(&now, &f->tv, &lat);
+    if (lat.tv_sec < 0)
+      us = 0;
+    else if (lat.tv_sec >= UINT32_MAX / 1000000)
+      us = UINT32_MAX;
+    else
+      us = lat.tv_sec * 1000000 + lat.tv_usec;
+    bin = us ? 32 - __builtin_clz(us) : 0;
+    status->latency[bin < STATUS_LATENCY_BINS ? bin : STATUS_LATENCY_BINS - 1]++;
+    status->latency_count++;
+    if (us > status->latency_max) status->latency_max = us;
+
+    if (!(f->frame.can_id & CAN_ERR_FLAG)) continue;
+
+    status->error_frames++;
+    status->can_state = status_can_state(status->can_state, &f->frame);
+    status->last_error_ns = (uint64_t)f->tv.tv_sec * 1000000000 + f->tv.tv_usec * 1000;
+    status->last_error_id = f->frame.can_id;
+    memcpy(status->last_error_data, f->frame.data, CAN_MAX_DLEN);
+  }
+}
+
+static uint32_t status_permille(double bytes_ps, unsigned int baud)
+{
+  return baud ? bytes_ps * 10 * 1000 / baud : 0;
+}
+
+static void status_update(void * ctx, const struct port_stats * ps)
+{
+  struct status * status = ctx;
+  struct h_slcand_status * page = status->page;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  page->updated_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  page->link_up = (ps->if_flags & IFF_UP) && (ps->if_flags & IFF_RUNNING);
+  page->operstate = ps->operstate;
+  /* a stopped interface reports no error frames that would say so */
+  page->can_state = ps->if_flags & IFF_UP ? status->can_state : CAN_STATE_STOPPED;
+  page->uart_rx_permille = status_permille(ps->uart_rx_bytes_ps, status->uart_baud);
+  page->uart_tx_permille = status_permille(ps->uart_tx_bytes_ps, status->uart_baud);
+  page->rx_fps = ps->rx_fps;
+  page->tx_fps = ps->tx_fps;
+
+  page->rx_frames = ps->link.rx_packets;
+  page->tx_frames = ps->link.tx_packets;
+  page->rx_errors = ps->link.rx_errors;
+  page->tx_errors = ps->link.tx_errors;
+  page->rx_dropped = ps->link.rx_dropped;
+  page->tx_dropped = ps->link.tx_dropped;
+
+  page->rx_delivered = ps->rx.delivered;
+  page->rx_socket_lost = ps->rx.socket_lost;
+  page->rx_output_lost = ps->rx.output_lost;
+
+  if (ps->icount_valid) {
+    page->uart_overrun = ps->icount.overrun;
+    page->uart_buf_overrun = ps->icount.buf_overrun;
+    page->uart_frame = ps->icount.frame;
+    page->uart_parity = ps->icount.parity;
+  }
+
+  page->last_error_ns = status->last_error_ns;
+  page->last_error_id = status->last_error_id;
+  memcpy(page->last_error_data, status->last_error_data, sizeof(page->last_error_data));
+  page->error_frames = status->error_frames;
+
+  page->latency_p50_us = status_percentile(status, 0.5);
+  page->latency_p99_us = status_percentile(status, 0.99);
+  page->latency_max_us = status->latency_max;
+
+  __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+
+  memset(status->latency, 0, sizeof(status->latency));
+  status->latency_count = 0;
+  status->latency_max = 0;
+}
+
+struct status * status_open(
+  const char * ifname, struct stats * st, unsigned int interval_ms, unsigned int uart_baud,
+  unsigned int max_delay_us)
+{
+  struct status * status;
+  int fd;
+
+  status = calloc(1, sizeof(*status));
+  if (!status) return NULL;
+
+  snprintf(status->name, sizeof(status->name), "/%s-%s", DAEMON_NAME, ifname);
+  status->uart_baud = uart_baud;
+  status->can_state = CAN_STATE_ERROR_ACTIVE;
+
+  fd = shm_open(status->name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) goto err_free;
+
+  if (ftruncate(fd, sizeof(*status->page)) < 0) goto err_unlink;
+  status->page = mmap(NULL, sizeof(*status->page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (status->page == MAP_FAILED) goto err_unlink;
+  close(fd);
+
+  status->page->version = H_SLCAND_STATUS_VERSION;
+  status->page->size = sizeof(*status->page);
+  status->page->interval_ms = interval_ms;
+  status->page->uart_baud = uart_baud;
+  status->page->can_state = status->can_state;
+  __atomic_store_n(&status->page->magic, H_SLCAND_STATUS_MAGIC, __ATOMIC_RELEASE);
+
+  if (rx_subscribe(status_rx, status, max_delay_us) < 0) {
+    status_close(status);
+    return NULL;
+  }
+  stats_notify(st, status_update, status);
+
+  return status;
+
+err_unlink:
+  close(fd);
+  shm_unlink(status->name);
+err_free:
+  free(status);
+  return NULL;
+}
+
+void status_close(struct status * status)
+{
+  munmap(status->page, sizeof(*status->page));
+  shm_unlink(status->name);
+  free(status);
+}
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * status.h - memory-mapped status page of the port
+ */
+
+#ifndef H_SLCAND_STATUS_PAGE_H
+#define H_SLCAND_STATUS_PAGE_H
+
+#include "stats.h"
+
+struct status;
+
+/*
+ * Create the status page of ifname (see h_slcand_status.h) and keep it up
+ * to date from every statistics sample of st and from the receive path.
+ */
+struct status * status_open(
+  const char * ifname, struct stats * st, unsigned int interval_ms, unsigned int uart_baud,
+  unsigned int max_delay_us);
+void status_close(struct status * status);
+
+#endif /* H_SLCAND_STATUS_PAGE_H */
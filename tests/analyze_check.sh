@@ -0,0 +1,62 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# analyze_check.sh - check h_slcand_analyze against synthetic logs
+#
+# Usage: analyze_check.sh <h_slcand_analyze>
+#
+# A small log with known gaps has to give exact statistics, and a large one
+# has to give the same report however it is split across threads.
+
+set -e
+
+analyze=${1:?usage: $0 <h_slcand_analyze>}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+# gaps of 0, 100 and 200 us: the 0 is the minimum, no percentile is above the maximum
+cat > "$dir/gaps.log" <<LOG
+(1000.000000) can0 123#00
+(1000.000000) can0 123#01
+(1000.000100) can0 123#02
+(1000.000300) can0 123#03
+LOG
+
+for j in 1 4; do
+  row=$("$analyze" -j $j "$dir/gaps.log" | grep '^123 ')
+  set -- $row
+  [ "$2" = 4 ] || fail "-j$j: $2 frames instead of 4"
+  [ "$4" = 0.000ms ] || fail "-j$j: min gap $4 instead of 0.000ms"
+  [ "$5" = 0.128ms ] || fail "-j$j: p50 gap $5 instead of 0.128ms"
+  [ "$6" = 0.200ms ] || fail "-j$j: p99 gap $6 instead of 0.200ms"
+  [ "$7" = 0.200ms ] || fail "-j$j: max gap $7 instead of 0.200ms"
+done
+
+# two million frames of five periodic identifiers with error bursts in between
+awk 'BEGIN {
+  t = 1000000000
+  for (i = 0; i < 2000000; i++) {
+    t += 50 + (i * 7919) % 200
+    id = i % 5
+    if (i % 100000 < 20)
+      line = "20000080#0000000000000000"
+    else if (id == 4)
+      line = sprintf("%08X#%016X", 0x18FF0000 + id, i)
+    else
+      line = sprintf("%03X#%02X", 0x100 + id, i % 256)
+    printf "(%d.%06d) can0 %s\n", t / 1000000, t % 1000000, line
+  }
+}' > "$dir/big.log"
+
+"$analyze" -j 1 "$dir/big.log" > "$dir/j1.txt"
+"$analyze" -j 4 "$dir/big.log" > "$dir/j4.txt"
+cmp -s "$dir/j1.txt" "$dir/j4.txt" || fail "-j1 and -j4 reports differ: $(diff "$dir/j1.txt" "$dir/j4.txt")"
+grep -q '^frames: *2000000 ' "$dir/j1.txt" || fail "frame count: $(head -1 "$dir/j1.txt")"
+grep -q '^errors: *400 error frames in 20 bursts' "$dir/j1.txt" || fail "$(grep '^errors' "$dir/j1.txt")"
+
+echo "PASS"
@@ -0,0 +1,57 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# rta_check.sh - check the response-time analysis of h_slcand -A
+#
+# Usage: rta_check.sh <h_slcand>
+#
+# The CAN hop has to reproduce the worked example of Davis, Burns, Bril and
+# Lukkien (2007), where the original analysis wrongly finds message C
+# schedulable, and the host bound UART has to carry the acks of tx frames.
+
+set -e
+
+slcand=${1:?usage: $0 <h_slcand>}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+  echo "FAIL: $*" >&2
+  exit 1
+}
+
+# 125 kbit/s, 7 data bytes: 125 bit times or 1 ms per frame, 97% bus load.
+# rx messages so that no UART delay turns into CAN release jitter.
+cat > "$dir/davis.txt" <<SET
+# id dlc period deadline
+001 7 2.5 2.5  rx
+002 7 3.5 3.25 rx
+003 7 3.5 3.25 rx
+SET
+
+rc=0
+"$slcand" -A "$dir/davis.txt" -S 3000000 -s4 > "$dir/out.txt" || rc=$?
+[ $rc = 1 ] || fail "exit code $rc instead of 1 for a deadline miss"
+
+for expect in "1 2.000" "2 3.000" "3 3.500"; do
+  set -- $expect
+  row=$(grep "^$1 " "$dir/out.txt") || fail "no row for message $1"
+  set -- $1 $2 $row
+  [ "$9" = "$2" ] || fail "message $1: CAN response $9 instead of $2 ms"
+done
+grep -q '^3 .*DEADLINE MISS$' "$dir/out.txt" || fail "message 3 does not miss its deadline"
+grep -q '^1 of 3 messages miss' "$dir/out.txt" || fail "$(tail -1 "$dir/out.txt")"
+
+# at 115200 baud the rx frame takes 22 characters (1.910 ms) and the ack of
+# the tx frame 2 more (0.174 ms) on the host bound direction
+cat > "$dir/ack.txt" <<SET
+100 8 10 10 tx
+200 8 10 10 rx
+SET
+
+"$slcand" -A "$dir/ack.txt" -S 115200 -s4 > "$dir/out.txt" ||
+  fail "deadline miss: $(cat "$dir/out.txt")"
+set -- $(grep '^200 ' "$dir/out.txt")
+[ "$6" = 2.083 ] || fail "host bound UART response $6 instead of 2.083 ms"
+
+echo "PASS"
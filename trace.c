@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * trace.c - opt-in pipeline tracing with Chrome/Perfetto JSON export
+ *
+ * Spans are appended to a preallocated ring with a single atomic index so
+ * the event loop and the recorder thread can both record without locks.
+ * Nothing is formatted until export, which happens once at shutdown. When
+ * the ring is full the oldest spans are overwritten, so the export always
+ * holds the run up to the shutdown.
+ */
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_event
+{
+  uint64_t begin;
+  uint32_t dur;
+  uint32_t arg;
+  uint16_t kind;
+  uint16_t tid;
+};
+
+static const char * const trace_names[TRACE_KIND_COUNT] = {
+  [TRACE_POLL_WAIT] = "poll wait",
+  [TRACE_SOCKET_QUEUE] = "socket queue",
+  [TRACE_RECV_BATCH] = "recv batch",
+  [TRACE_RING_STORE] = "ring store",
+  [TRACE_TRIGGER_COPY] = "trigger copy",
+  [TRACE_DUMP_WRITE] = "dump write",
+  [TRACE_STATS_SAMPLE] = "stats sample",
+  [TRACE_SEND_BATCH] = "send batch",
+};
+
+int trace_enabled;
+
+static struct trace_event * events;
+static unsigned int capacity;
+static atomic_ullong used;
+static _Thread_local uint16_t thread_id;
+
+int trace_open(unsigned int cap)
+{
+  /* touch all pages now so tracing never faults at runtime */
+  events = malloc((size_t)cap * sizeof(*events));
+  if (!events) return -1;
+  memset(events, 0, (size_t)cap * sizeof(*events));
+
+  capacity = cap;
+  trace_enabled = 1;
+  return 0;
+}
+
+uint64_t trace_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void trace_span(enum trace_kind kind, uint64_t begin, uint64_t end, uint32_t arg)
+{
+  struct trace_event * ev;
+  unsigned long long i;
+
+  if (!trace_enabled) return;
+
+  i = atomic_fetch_add_explicit(&used, 1, memory_order_relaxed);
+  if (!thread_id) thread_id = gettid();
+
+  ev = &events[i % capacity];
+  ev->begin = begin;
+  ev->dur = end > begin ? end - begin : 0;
+  ev->arg = arg;
+  ev->kind = kind;
+  /* per-frame queueing spans get their own track so they nest cleanly */
+  ev->tid = kind == TRACE_SOCKET_QUEUE ? 0 : thread_id;
+}
+
+int trace_export(const char * path)
+{
+  unsigned long long total = atomic_load(&used);
+  unsigned long long first = total > capacity ? total - capacity : 0;
+  unsigned int n = total - first;
+  unsigned int i;
+  FILE * f;
+  int pid = getpid();
+
+  if (!trace_enabled) return 0;
+  trace_enabled = 0;
+
+  f = fopen(path, "w");
+  if (!f) goto err;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(
+    f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+       "\"args\":{\"name\":\"kernel socket queue\"}}%s\n",
+    pid, n ? "," : "");
+  for (i = 0; i < n; i++) {
+    const struct trace_event * ev = &events[(first + i) % capacity];
+
+    /* Chrome trace timestamps are microseconds */
+    fprintf(
+      f,
+      "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%u.%03u,\"pid\":%d,\"tid\":%u,"
+      "\"args\":{\"count\":%u}}%s\n",
+      trace_names[ev->kind], (unsigned long long)(ev->begin / 1000), (unsigned)(ev->begin % 1000),
+      ev->dur / 1000, ev->dur % 1000, pid, ev->tid, ev->arg, i + 1 < n ? "," : "");
+  }
+  fprintf(f, "],\"otherData\":{\"overwritten\":\"%llu\"}}\n", first);
+
+  if (fclose(f) == EOF) goto err;
+  free(events);
+  return 0;
+
+err:
+  free(events);
+  return -1;
+}
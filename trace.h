@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * trace.h - opt-in pipeline tracing with Chrome/Perfetto JSON export
+ */
+
+#ifndef H_SLCAND_TRACE_H
+#define H_SLCAND_TRACE_H
+
+#include <stdint.h>
+
+enum trace_kind
+{
+  TRACE_POLL_WAIT,
+  TRACE_SOCKET_QUEUE,
+  TRACE_RECV_BATCH,
+  TRACE_RING_STORE,
+  TRACE_TRIGGER_COPY,
+  TRACE_DUMP_WRITE,
+  TRACE_STATS_SAMPLE,
+  TRACE_SEND_BATCH,
+  TRACE_KIND_COUNT
+};
+
+extern int trace_enabled;
+
+/* Preallocate a ring keeping the last capacity spans and start recording */
+int trace_open(unsigned int capacity);
+
+/* Write all recorded spans as a Chrome trace event JSON file and free the buffer */
+int trace_export(const char * path);
+
+/* CLOCK_REALTIME in ns, the clock kernel frame timestamps use */
+uint64_t trace_now(void);
+
+/* Record a span from begin to end (ns); arg is shown as the span's count */
+void trace_span(enum trace_kind kind, uint64_t begin, uint64_t end, uint32_t arg);
+
+#endif /* H_SLCAND_TRACE_H */
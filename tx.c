@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * tx.c - shared transmit path of the daemon's frame sources
+ *
+ * The socketcand server, the virtual ports, the scheduler, the SYNC aligned
+ * release and the generator all write to one non-blocking CAN_RAW socket on
+ * the slcan netdevice, from where the line discipline encodes the frames
+ * onto the UART. Batches go out with sendmmsg(). A frame the netdevice
+ * queue cannot take is not retried, its source counts it as dropped.
+ *
+ * A hold (the SYNC aligned release) sees every frame first and may keep it
+ * to send it later with tx_send_now().
+ */
+
+#define _GNU_SOURCE
+
+#include "tx.h"
+
+#include <linux/can/raw.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Frames sent per sendmmsg() */
+#define TX_BATCH 64
+
+static struct
+{
+  int sock;
+  tx_hold_t hold;
+  void * hold_ctx;
+  struct mmsghdr msgs[TX_BATCH];
+  struct iovec iov[TX_BATCH];
+} tx = {.sock = -1};
+
+int tx_send_now(const struct can_frame * frames, int n)
+{
+  int total = 0;
+  int batch, sent, i;
+  uint64_t begin;
+
+  while (total < n) {
+    batch = n - total < TX_BATCH ? n - total : TX_BATCH;
+    for (i = 0; i < batch; i++) tx.iov[i].iov_base = (void *)&frames[total + i];
+
+    begin = trace_enabled ? trace_now() : 0;
+    sent = sendmmsg(tx.sock, tx.msgs, batch, MSG_DONTWAIT);
+    if (trace_enabled) trace_span(TRACE_SEND_BATCH, begin, trace_now(), sent > 0 ? sent : 0);
+    if (sent <= 0) break;
+    total += sent;
+    if (sent < batch) break;
+  }
+
+  return total;
+}
+
+int tx_send(const struct can_frame * frames, int n)
+{
+  int taken = n;
+  int start = 0;
+  int i;
+
+  if (!tx.hold) return tx_send_now(frames, n);
+
+  /* send the runs of frames between the held ones */
+  for (i = 0; i <= n; i++) {
+    if (i < n && tx.hold(tx.hold_ctx, &frames[i]) < 0) continue;
+    taken -= i - start - tx_send_now(&frames[start], i - start);
+    start = i + 1;
+  }
+
+  return taken;
+}
+
+void tx_hold(tx_hold_t hold, void * ctx)
+{
+  tx.hold = hold;
+  tx.hold_ctx = ctx;
+}
+
+int tx_open(int ifindex)
+{
+  struct sockaddr_can addr;
+  int i;
+
+  for (i = 0; i < TX_BATCH; i++) {
+    tx.iov[i].iov_len = sizeof(struct can_frame);
+    tx.msgs[i].msg_hdr.msg_iov = &tx.iov[i];
+    tx.msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  tx.sock = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+  if (tx.sock < 0) return -1;
+
+  /* nothing is ever read from it, the shared receive path sees all frames */
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifindex;
+  if (
+    setsockopt(tx.sock, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0 ||
+    bind(tx.sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(tx.sock);
+    tx.sock = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void tx_close(void)
+{
+  if (tx.sock < 0) return;
+
+  close(tx.sock);
+  tx.sock = -1;
+  tx.hold = NULL;
+}
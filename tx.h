@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * tx.h - shared transmit path of the daemon's frame sources
+ */
+
+#ifndef H_SLCAND_TX_H
+#define H_SLCAND_TX_H
+
+#include <linux/can.h>
+
+/* Open the CAN_RAW socket all frame sources send on */
+int tx_open(int ifindex);
+void tx_close(void);
+
+/*
+ * Queue frames to the netdevice with as few system calls as possible,
+ * offering each to the hold first. Returns how many were queued or held;
+ * the rest did not fit into the netdevice queue and are dropped.
+ */
+int tx_send(const struct can_frame * frames, int n);
+
+/* Queue frames without offering them to the hold, returns how many were queued */
+int tx_send_now(const struct can_frame * frames, int n);
+
+/* Returns 0 if it takes cf to send it later itself, -1 to let it go out now */
+typedef int (*tx_hold_t)(void * ctx, const struct can_frame * cf);
+
+/* Offer every frame of tx_send() to hold first */
+void tx_hold(tx_hold_t hold, void * ctx);
+
+#endif /* H_SLCAND_TX_H */
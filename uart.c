@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * uart.c - UART baud rate selection
+ *
+ * USB serial bridges derive the baud rate from a divisor, so an arbitrary
+ * rate is only approximated, and the adapter's own UART has its own
+ * rounding. At high rates the mismatch shows up as framing errors under
+ * load. The rate the driver programmed is read back after every change, and
+ * an optional probe measures the link at the rates around the requested one
+ * instead of trusting the arithmetic.
+ */
+
+#include "uart.h"
+
+#include <asm-generic/ioctls.h>
+#include <errno.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "dialect.h"
+#include "h_slcand.h"
+
+/* Queries sent back to back per candidate rate */
+#define UART_PROBE_BURST 32
+
+/* Candidate rates are speed * (1 +- n * step), in permille */
+#define UART_PROBE_STEP 5
+#define UART_PROBE_STEPS 4
+
+/* How long to wait for more replies */
+#define UART_REPLY_MS 100
+
+/* Time for the adapter to stop sending frames after 'C' */
+#define UART_SETTLE_US 20000
+
+/* Sent at the chosen rate to end any command garbled at another one */
+#define UART_CLEAR "\r\r\r"
+
+struct uart_score
+{
+  unsigned int requested;
+  unsigned int actual;
+  int replies;
+  int errors;
+};
+
+unsigned int uart_set_speed(int fd, struct termios2 * tios, unsigned int speed)
+{
+  tios->c_cflag &= ~CBAUD;
+  tios->c_cflag |= BOTHER;
+  tios->c_ispeed = speed;
+  tios->c_ospeed = speed;
+
+  if (ioctl(fd, TCSETS2, tios) < 0 || ioctl(fd, TCGETS2, tios) < 0) return 0;
+  return tios->c_ospeed;
+}
+
+static int icount_errors(int fd)
+{
+  struct serial_icounter_struct ic;
+
+  if (ioctl(fd, TIOCGICOUNT, &ic) < 0) return 0;
+  return ic.frame + ic.overrun + ic.parity + ic.buf_overrun;
+}
+
+/* Send a burst of version queries and count the well formed replies */
+static void uart_measure(int fd, struct uart_score * s)
+{
+  char burst[2 * UART_PROBE_BURST];
+  struct pollfd pfd = {fd, POLLIN, 0};
+  char buf[256];
+  int errors, lines = 0, good = 1;
+  ssize_t n, i;
+
+  for (i = 0; i < UART_PROBE_BURST; i++) memcpy(&burst[2 * i], "V\r", 2);
+
+  ioctl(fd, TCFLSH, TCIOFLUSH);
+  errors = icount_errors(fd);
+  if (write(fd, burst, sizeof(burst)) != sizeof(burst)) return;
+
+  while (lines < UART_PROBE_BURST && poll(&pfd, 1, UART_REPLY_MS) > 0) {
+    n = read(fd, buf, sizeof(buf));
+    if (n <= 0) break;
+
+    /* a good reply is 'V' followed by printable characters and CR */
+    for (i = 0; i < n; i++) {
+      if (buf[i] == '\r' || buf[i] == '\a') {
+        if (good == 2 && buf[i] == '\r') s->replies++;
+        lines++;
+        good = 1;
+      } else if (good == 1) {
+        good = buf[i] == 'V' ? 2 : 0;
+      } else if (buf[i] < ' ' || buf[i] > '~') {
+        good = 0;
+      }
+    }
+  }
+
+  s->errors = icount_errors(fd) - errors;
+}
+
+/* Most replies, then fewest errors, then closest to the requested speed */
+static int uart_better(const struct uart_score * a, const struct uart_score * b, unsigned int speed)
+{
+  if (a->replies != b->replies) return a->replies > b->replies;
+  if (a->errors != b->errors) return a->errors < b->errors;
+  return labs((long)a->actual - (long)speed) < labs((long)b->actual - (long)speed);
+}
+
+unsigned int uart_probe(int fd, struct termios2 * tios, unsigned int speed)
+{
+  struct uart_score best = {speed, 0, -1, 0};
+  struct uart_score s;
+  unsigned int last = 0;
+  int step;
+
+  for (step = -UART_PROBE_STEPS; step <= UART_PROBE_STEPS; step++) {
+    memset(&s, 0, sizeof(s));
+    s.requested = (unsigned long long)speed * (1000 + step * UART_PROBE_STEP) / 1000;
+    s.actual = uart_set_speed(fd, tios, s.requested);
+    if (!s.actual) continue;
+
+    /* neighbouring requests often map onto the same divisor */
+    if (s.actual == last) continue;
+    last = s.actual;
+
+    send_command(fd, "C\r");
+    usleep(UART_SETTLE_US);
+    uart_measure(fd, &s);
+    syslogger(
+      LOG_INFO, "UART probe at %u baud (%u requested): %d/%d replies, %d line errors\n", s.actual,
+      s.requested, s.replies, UART_PROBE_BURST, s.errors);
+
+    if (best.replies < 0 || uart_better(&s, &best, speed)) best = s;
+  }
+
+  if (best.replies <= 0) {
+    syslogger(LOG_NOTICE, "UART probe got no replies, keeping %u baud\n", speed);
+    best.requested = speed;
+  }
+
+  best.actual = uart_set_speed(fd, tios, best.requested);
+  if (!best.actual) return 0;
+
+  /*
+   * Queries sent at a mismatched rate may have left a partial command in the
+   * adapter's buffer, which would corrupt the first setup command. Terminate
+   * it and discard the error replies.
+   */
+  send_command(fd, UART_CLEAR);
+  ioctl(fd, TCSBRK, 1);
+  usleep(UART_SETTLE_US);
+  ioctl(fd, TCFLSH, TCIFLUSH);
+
+  return best.actual;
+}
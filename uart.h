@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * uart.h - UART baud rate selection
+ */
+
+#ifndef H_SLCAND_UART_H
+#define H_SLCAND_UART_H
+
+#include <asm-generic/termbits.h>
+
+/*
+ * Apply tios with an arbitrary baud rate and read the rate the driver
+ * actually programmed back. Returns that rate, or 0 with errno set.
+ */
+unsigned int uart_set_speed(int fd, struct termios2 * tios, unsigned int speed);
+
+/*
+ * Try rates within 2% of speed, sending bursts of 'V' queries to the
+ * closed adapter at each, and leave the port at the one with the most
+ * correct replies and fewest line errors, with the adapter's command buffer
+ * cleared at that rate. Returns the achieved rate, or 0 with errno set if
+ * the port could not be configured.
+ */
+unsigned int uart_probe(int fd, struct termios2 * tios, unsigned int speed);
+
+#endif /* H_SLCAND_UART_H */
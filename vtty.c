@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * vtty.c - virtual SLCAN serial ports sharing the adapter
+ *
+ * Tools that insist on an SLCAN serial port get a pseudo-terminal instead of
+ * the real adapter. Received frames are encoded as SLCAN lines straight from
+ * the shared receive path, and frames the tool sends are parsed and written
+ * to the shared transmit path on the slcan netdevice, where the line
+ * discipline merges them with all other traffic. Setup commands (bitrate, filters,
+ * timestamps) are acknowledged but ignored, the real adapter is configured
+ * by the daemon.
+ *
+ * Like on a real adapter a tool does not receive its own frames back, but
+ * it does receive the frames of other local programs.
+ *
+ * The daemon keeps the slave side open itself, so a tool closing the port
+ * does not make the master hang up. Frames are only forwarded while the
+ * channel is open, and frames the tool does not read in time are discarded
+ * and reported as output losses.
+ */
+
+#define _GNU_SOURCE
+
+#include "vtty.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/can.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "evloop.h"
+#include "h_slcand.h"
+#include "rx.h"
+#include "tx.h"
+
+/* Longest SLCAN command line */
+#define VTTY_LINE_LENGTH 64
+
+/* Output buffered per port */
+#define VTTY_OUT_LENGTH 16384
+
+/* Answer of the version commands, a Lawicel CANUSB firmware */
+#define VTTY_VERSION "V1013\r"
+
+struct vtty
+{
+  int slave;
+  struct ev_source src;
+  char link[PATH_MAX];
+  int open;
+  unsigned long dropped;
+  struct rx_echo echo;
+
+  char line[VTTY_LINE_LENGTH];
+  size_t line_len;
+
+  char out[VTTY_OUT_LENGTH];
+  size_t out_len;
+  int polling_out;
+};
+
+static void vtty_flush(struct vtty * vt)
+{
+  ssize_t n;
+  int want;
+
+  while (vt->out_len) {
+    n = write(vt->src.fd, vt->out, vt->out_len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    vt->out_len -= n;
+    memmove(vt->out, vt->out + n, vt->out_len);
+  }
+
+  want = vt->out_len > 0;
+  if (want != vt->polling_out && !ev_mod(&vt->src, EPOLLIN | (want ? EPOLLOUT : 0)))
+    vt->polling_out = want;
+}
+
+static int vtty_put(struct vtty * vt, const char * s, size_t len)
+{
+  if (vt->out_len + len > sizeof(vt->out)) return -1;
+  memcpy(vt->out + vt->out_len, s, len);
+  vt->out_len += len;
+  return 0;
+}
+
+/* Encode cf as an SLCAN line, returns its length or 0 for frames SLCAN cannot carry */
+static int vtty_encode(char * buf, const struct can_frame * cf)
+{
+  int rtr = cf->can_id & CAN_RTR_FLAG;
+  int len, i;
+
+  if (cf->can_id & CAN_ERR_FLAG) return 0;
+
+  if (cf->can_id & CAN_EFF_FLAG)
+    len = sprintf(buf, "%c%08X%d", rtr ? 'R' : 'T', cf->can_id & CAN_EFF_MASK, cf->len);
+  else
+    len = sprintf(buf, "%c%03X%d", rtr ? 'r' : 't', cf->can_id & CAN_SFF_MASK, cf->len);
+
+  for (i = 0; !rtr && i < cf->len; i++) len += sprintf(buf + len, "%02X", cf->data[i]);
+  buf[len++] = '\r';
+  return len;
+}
+
+static void vtty_rx(void * ctx, const struct rx_frame * frames, int n)
+{
+  struct vtty * vt = ctx;
+  char buf[32 + 2 * CAN_MAX_DLEN];
+  int i, len, lost = 0;
+
+  if (!vt->open) return;
+
+  for (i = 0; i < n; i++) {
+    if (rx_echo_match(&vt->echo, &frames[i])) continue;
+    len = vtty_encode(buf, &frames[i].frame);
+    if (len && vtty_put(vt, buf, len) < 0) lost++;
+  }
+
+  if (lost) {
+    vt->dropped += lost;
+    rx_output_lost(lost);
+  }
+  vtty_flush(vt);
+}
+
+static int hex_value(const char * s, int digits, unsigned long * value)
+{
+  char buf[9];
+  char * end;
+
+  if ((int)strnlen(s, digits) < digits) return -1;
+  memcpy(buf, s, digits);
+  buf[digits] = '\0';
+  *value = strtoul(buf, &end, 16);
+  return *end ? -1 : 0;
+}
+
+/* Parse a t/T/r/R line and send it, returns -1 for malformed lines */
+static int vtty_send(struct vtty * vt, const char * line)
+{
+  int eff = line[0] == 'T' || line[0] == 'R';
+  int rtr = line[0] == 'r' || line[0] == 'R';
+  int digits = eff ? 8 : 3;
+  struct can_frame cf;
+  unsigned long v;
+  int i;
+
+  memset(&cf, 0, sizeof(cf));
+  if (hex_value(line + 1, digits, &v) < 0) return -1;
+  cf.can_id = v | (eff ? CAN_EFF_FLAG : 0) | (rtr ? CAN_RTR_FLAG : 0);
+  line += 1 + digits;
+
+  if (*line < '0' || *line > '8') return -1;
+  cf.len = *line++ - '0';
+
+  for (i = 0; !rtr && i < cf.len; i++, line += 2) {
+    if (hex_value(line, 2, &v) < 0) return -1;
+    cf.data[i] = v;
+  }
+  if (*line) return -1;
+
+  /* a full netdevice queue is reported like a full adapter buffer */
+  if (tx_send(&cf, 1) != 1) return -1;
+  rx_echo_sent(&vt->echo, &cf);
+  return 0;
+}
+
+static void vtty_command(struct vtty * vt, const char * line)
+{
+  const char * reply = "\r";
+
+  switch (line[0]) {
+    case 't':
+    case 'r':
+      reply = vtty_send(vt, line) < 0 ? "\a" : "z\r";
+      break;
+    case 'T':
+    case 'R':
+      reply = vtty_send(vt, line) < 0 ? "\a" : "Z\r";
+      break;
+    case 'O':
+    case 'L':
+      vt->open = 1;
+      break;
+    case 'C':
+      vt->open = 0;
+      break;
+    case 'V':
+    case 'v':
+      reply = VTTY_VERSION;
+      break;
+    case 'N':
+      reply = "NHSLC\r";
+      break;
+    case 'F':
+      reply = "F00\r";
+      break;
+    case 'S':
+    case 's':
+    case 'M':
+    case 'm':
+    case 'Z':
+    case 'W':
+    case 'Q':
+    case 'X':
+      break;
+    default:
+      reply = "\a";
+      break;
+  }
+
+  vtty_put(vt, reply, strlen(reply));
+}
+
+static void vtty_event(void * ctx, unsigned int events)
+{
+  struct vtty * vt = ctx;
+  char buf[256];
+  ssize_t n, i;
+
+  if (events & EPOLLIN) {
+    n = read(vt->src.fd, buf, sizeof(buf));
+    for (i = 0; i < n; i++) {
+      if (buf[i] != '\r' && buf[i] != '\n') {
+        /* overlong lines are dropped as a whole */
+        if (vt->line_len < sizeof(vt->line)) vt->line[vt->line_len] = buf[i];
+        vt->line_len++;
+        continue;
+      }
+
+      if (vt->line_len && vt->line_len < sizeof(vt->line)) {
+        vt->line[vt->line_len] = '\0';
+        vtty_command(vt, vt->line);
+      } else if (vt->line_len) {
+        vtty_put(vt, "\a", 1);
+      }
+      vt->line_len = 0;
+    }
+  }
+
+  vtty_flush(vt);
+}
+
+struct vtty * vtty_open(const char * link, unsigned int max_delay_us)
+{
+  struct vtty * vt;
+  struct termios tios;
+  struct stat st;
+  const char * name;
+
+  vt = calloc(1, sizeof(*vt));
+  if (!vt) return NULL;
+
+  vt->slave = -1;
+  vt->src.fd = -1;
+  snprintf(vt->link, sizeof(vt->link), "%s", link);
+
+  vt->src.fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (vt->src.fd < 0 || grantpt(vt->src.fd) < 0 || unlockpt(vt->src.fd) < 0) goto err;
+
+  name = ptsname(vt->src.fd);
+  if (!name) goto err;
+  vt->slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (vt->slave < 0) goto err;
+
+  /* no echo and no line ending translation, tools may not set the port up */
+  if (tcgetattr(vt->slave, &tios) < 0) goto err;
+  cfmakeraw(&tios);
+  if (tcsetattr(vt->slave, TCSANOW, &tios) < 0) goto err;
+
+  /* replace a stale link left behind, but never a real file */
+  if (!lstat(vt->link, &st) && S_ISLNK(st.st_mode)) unlink(vt->link);
+  if (symlink(name, vt->link) < 0) goto err;
+
+  vt->src.cb = vtty_event;
+  vt->src.ctx = vt;
+  if (ev_add(&vt->src, EPOLLIN) < 0) goto err_unlink;
+
+  if (rx_subscribe(vtty_rx, vt, max_delay_us) < 0) {
+    vtty_close(vt);
+    return NULL;
+  }
+
+  syslogger(LOG_NOTICE, "virtual SLCAN port %s on %s\n", vt->link, name);
+  return vt;
+
+err_unlink:
+  unlink(vt->link);
+err:
+  if (vt->slave >= 0) close(vt->slave);
+  if (vt->src.fd >= 0) close(vt->src.fd);
+  free(vt);
+  return NULL;
+}
+
+void vtty_close(struct vtty * vt)
+{
+  if (vt->dropped)
+    syslogger(LOG_INFO, "virtual SLCAN port %s dropped %lu frames\n", vt->link, vt->dropped);
+
+  ev_del(&vt->src);
+  unlink(vt->link);
+  close(vt->slave);
+  close(vt->src.fd);
+  free(vt);
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * vtty.h - virtual SLCAN serial ports sharing the adapter
+ */
+
+#ifndef H_SLCAND_VTTY_H
+#define H_SLCAND_VTTY_H
+
+/* Maximum number of virtual ports */
+#define VTTY_MAX_PORTS 4
+
+struct vtty;
+
+/*
+ * Create a pseudo-terminal speaking the SLCAN ASCII protocol, reachable
+ * through a symlink at link. Once a tool opens the channel ('O' or 'L') it
+ * receives the frames of the shared receive path, coalesced by up to
+ * max_delay_us, and its t/T/r/R commands are sent on the shared transmit
+ * path.
+ */
+struct vtty * vtty_open(const char * link, unsigned int max_delay_us);
+void vtty_close(struct vtty * vt);
+
+#endif /* H_SLCAND_VTTY_H */